@@ -4,35 +4,54 @@
 
 #include <GGNoRe-CPP-API-IntegrationsTest.hpp>
 
+#include <TEST_SimulationWorker.hpp>
 #include <TEST_SystemMock.hpp>
 
+#include <chrono>
+#include <functional>
+
 using namespace GGNoRe::API;
 
+// Where the time of the sweep goes, the setup and the teardown should stay small compared to running the rollback logic
+struct PhasesStatistics
+{
+	size_t TestsCount = 0;
+	std::chrono::steady_clock::duration SetupDuration{};
+	std::chrono::steady_clock::duration RunDuration{};
+	std::chrono::steady_clock::duration TeardownDuration{};
+};
+PhasesStatistics PhasesUsage;
+
+bool ShouldSkipTest(const DATA_CFG Config, const TestEnvironment Environment, const PlayersSetup Setup)
+{
+	const bool AllowLocalDoubleSimulation = Setup.LocalMockHardwareFrameDurationInSeconds > Config.SimulationConfiguration.FrameDurationInSeconds;
+
+	// Creates too many edge cases around test initialization
+	return AllowLocalDoubleSimulation;
+}
+
 bool Test1Local1RemoteMockRollback(const DATA_CFG Config, const TestEnvironment Environment, const PlayersSetup Setup)
 {
 	assert(Environment.ReceiveRemoteIntervalInFrames > 0);
 	assert(Setup.LocalMockHardwareFrameDurationInSeconds > 0.f);
 	assert(Setup.RemoteMockHardwareFrameDurationInSeconds > 0.f);
 
-	DATA_CFG::Load(Config);
+	// The sweep planner prunes the skipped configurations before running them, so the local player never double simulates
+	assert(!ShouldSkipTest(Config, Environment, Setup));
 
-	const bool AllowLocalDoubleSimulation = Setup.LocalMockHardwareFrameDurationInSeconds > Config.SimulationConfiguration.FrameDurationInSeconds;
-	if (AllowLocalDoubleSimulation)
-	{
-		// Creates too many edge cases around test initialization
-		return true;
-	}
+	const auto SetupStart = std::chrono::steady_clock::now();
+
+	DATA_CFG::Load(Config);
 
 	const bool AllowRemoteDoubleSimulation = Setup.RemoteMockHardwareFrameDurationInSeconds > Config.SimulationConfiguration.FrameDurationInSeconds;
 
-	const bool AllowLocalStallAdvantage = Environment.ReceiveRemoteIntervalInFrames > 1 || AllowLocalDoubleSimulation;
+	const bool AllowLocalStallAdvantage = Environment.ReceiveRemoteIntervalInFrames > 1;
 	const bool AllowRemoteStallAdvantage = Environment.ReceiveRemoteIntervalInFrames > 1 || AllowRemoteDoubleSimulation;
 
 	const bool RoundTripPossibleWithinRollbackWindow = (size_t)Environment.ReceiveRemoteIntervalInFrames * 2 < Config.RollbackConfiguration.MinRollbackFrameCount;
 
 	const bool AllowLocalStarvedForInput =
-		(size_t)AllowRemoteStallAdvantage * (Config.SimulationConfiguration.StallTimerDurationInSeconds < Setup.RemoteMockHardwareFrameDurationInSeconds) * Config.RollbackConfiguration.MinRollbackFrameCount +
-		(size_t)AllowLocalDoubleSimulation * (Config.SimulationConfiguration.DoubleSimulationTimerDurationInSeconds < Setup.LocalMockHardwareFrameDurationInSeconds) * Config.RollbackConfiguration.MinRollbackFrameCount >=
+		(size_t)AllowRemoteStallAdvantage * (Config.SimulationConfiguration.StallTimerDurationInSeconds < Setup.RemoteMockHardwareFrameDurationInSeconds) * Config.RollbackConfiguration.MinRollbackFrameCount >=
 			Config.RollbackConfiguration.MinRollbackFrameCount ||
 		AllowRemoteDoubleSimulation ||
 		!RoundTripPossibleWithinRollbackWindow;
@@ -40,7 +59,6 @@ bool Test1Local1RemoteMockRollback(const DATA_CFG Config, const TestEnvironment
 		(size_t)AllowLocalStallAdvantage * (Config.SimulationConfiguration.StallTimerDurationInSeconds < Setup.LocalMockHardwareFrameDurationInSeconds) * Config.RollbackConfiguration.MinRollbackFrameCount +
 		(size_t)AllowRemoteDoubleSimulation * (Config.SimulationConfiguration.DoubleSimulationTimerDurationInSeconds < Setup.RemoteMockHardwareFrameDurationInSeconds) * Config.RollbackConfiguration.MinRollbackFrameCount >=
 			Config.RollbackConfiguration.MinRollbackFrameCount ||
-		AllowLocalDoubleSimulation ||
 		!RoundTripPossibleWithinRollbackWindow;
 
 	const uint8_t Player1SystemIndex = 0;
@@ -49,64 +67,252 @@ bool Test1Local1RemoteMockRollback(const DATA_CFG Config, const TestEnvironment
 	// In this test, local updates before remote and the activations are order sensitive so the player ids are used to ensure proper ordering
 	assert(TEST_NSPC_Systems::Player1Id < TEST_NSPC_Systems::Player2Id);
 
-	TEST_NSPC_Systems::TEST_SystemMock Local(
-		DATA_Player{ TEST_NSPC_Systems::Player1Id, true, Setup.LocalStartFrameIndex, Player1SystemIndex },
-		DATA_Player{ TEST_NSPC_Systems::Player2Id, false, uint16_t(Setup.LocalStartFrameIndex + Setup.RemoteStartOffsetInFrames), Player1SystemIndex },
-		Setup.LocalMockHardwareFrameDurationInSeconds,
-		Setup
-	);
-	TEST_NSPC_Systems::TEST_SystemMock Remote(
-		DATA_Player{ TEST_NSPC_Systems::Player2Id, true, uint16_t(Setup.LocalStartFrameIndex + Setup.RemoteStartOffsetInFrames), Player2SystemIndex },
-		DATA_Player{ TEST_NSPC_Systems::Player1Id, false,  uint16_t(Setup.LocalStartFrameIndex + Setup.RemoteStartOffsetInFrames), Player2SystemIndex },
-		Setup.RemoteMockHardwareFrameDurationInSeconds,
-		Setup
-	);
-
-	for (size_t IterationIndex = 0; IterationIndex < Environment.TestDurationInFrames; ++IterationIndex)
+	std::chrono::steady_clock::time_point RunStart;
+	std::chrono::steady_clock::time_point TeardownStart;
+
+	// The mocks are destroyed before the teardown is timed as over, so that it accounts for releasing the players
 	{
-		const uint16_t TestFrameIndex = (uint16_t)IterationIndex + Setup.LocalStartFrameIndex;
+		TEST_NSPC_Systems::TEST_SystemMock Local(
+			DATA_Player{ TEST_NSPC_Systems::Player1Id, true, Setup.LocalStartFrameIndex, Player1SystemIndex },
+			DATA_Player{ TEST_NSPC_Systems::Player2Id, false, uint16_t(Setup.LocalStartFrameIndex + Setup.RemoteStartOffsetInFrames), Player1SystemIndex },
+			Setup.LocalMockHardwareFrameDurationInSeconds,
+			Setup,
+			Environment.PipelinedRendering
+		);
+		TEST_NSPC_Systems::TEST_SystemMock Remote(
+			DATA_Player{ TEST_NSPC_Systems::Player2Id, true, uint16_t(Setup.LocalStartFrameIndex + Setup.RemoteStartOffsetInFrames), Player2SystemIndex },
+			DATA_Player{ TEST_NSPC_Systems::Player1Id, false,  uint16_t(Setup.LocalStartFrameIndex + Setup.RemoteStartOffsetInFrames), Player2SystemIndex },
+			Setup.RemoteMockHardwareFrameDurationInSeconds,
+			Setup,
+			Environment.PipelinedRendering
+		);
 
-		Local.PreUpdate(TestFrameIndex, Remote);
-		Remote.PreUpdate(TestFrameIndex, Local);
+		for (uint16_t SpectatorIndex = 0; SpectatorIndex < Environment.SpectatorsCount; ++SpectatorIndex)
+		{
+			TEST_NSPC_Systems::InputsBroadcast.AddSpectator();
+		}
+		TEST_Player::RecordUploads(Environment.SpectatorsCount > 0);
 
-		assert(Local.IsRunning());
+		RunStart = std::chrono::steady_clock::now();
 
-		Local.Update
-		(
-			{
-				AllowLocalDoubleSimulation,
-				AllowLocalStallAdvantage,
-				AllowLocalStarvedForInput,
-				Setup.LocalMockHardwareFrameDurationInSeconds < Config.SimulationConfiguration.FrameDurationInSeconds
-			},
-			Remote
-		);
 
-		if (Remote.IsRunning())
+		for (size_t IterationIndex = 0; IterationIndex < Environment.TestDurationInFrames; ++IterationIndex)
 		{
-			Remote.Update
-			(
+			const uint16_t TestFrameIndex = (uint16_t)IterationIndex + Setup.LocalStartFrameIndex;
+
+			const bool AllowModuleAllocations = Environment.ZeroAllocationWarmupInFrames == 0 || IterationIndex < Environment.ZeroAllocationWarmupInFrames;
+
+			Local.PreUpdate(TestFrameIndex, Remote);
+			Remote.PreUpdate(TestFrameIndex, Local);
+
+			assert(Local.IsRunning());
+
+			const auto SimulateFrame = [&]()
+			{
+				Local.Update
+				(
+					{
+						false, // Skipped configurations
+						AllowLocalStallAdvantage,
+						AllowLocalStarvedForInput,
+						Setup.LocalMockHardwareFrameDurationInSeconds < Config.SimulationConfiguration.FrameDurationInSeconds,
+						AllowModuleAllocations
+					},
+					Remote
+				);
+
+				if (Remote.IsRunning())
 				{
-					AllowRemoteDoubleSimulation,
-					AllowRemoteStallAdvantage,
-					AllowRemoteStarvedForInput,
-					Setup.RemoteMockHardwareFrameDurationInSeconds < Config.SimulationConfiguration.FrameDurationInSeconds
-				},
-				Local
-			);
-		}
+					Remote.Update
+					(
+						{
+							AllowRemoteDoubleSimulation,
+							AllowRemoteStallAdvantage,
+							AllowRemoteStarvedForInput,
+							Setup.RemoteMockHardwareFrameDurationInSeconds < Config.SimulationConfiguration.FrameDurationInSeconds,
+							AllowModuleAllocations
+						},
+						Local
+					);
+				}
+			};
 
-		Local.PostUpdate(TestFrameIndex, Remote);
-		Remote.PostUpdate(TestFrameIndex, Local);
+			if (Environment.PipelinedRendering)
+			{
+				// Both systems share the module singletons so they are simulated one after the other on the same worker thread
+				static TEST_SimulationWorker Worker;
+				// By reference so that posting does not allocate, the frame is waited for before the lambda goes out of scope
+				Worker.Post(std::cref(SimulateFrame));
 
-		// Must be "greater than" in order to make sure that the initialization packet is loaded first otherwise it might be overwritten by a regular packet
-		if (IterationIndex > (size_t)Setup.RemoteStartOffsetInFrames && IterationIndex % Environment.ReceiveRemoteIntervalInFrames == 0)
-		{
-			TEST_NSPC_Systems::TransferLocalPlayersInputs();
+				// Stands for the rendering, which must not allocate since the allocation counters are not shared safely between threads
+				do
+				{
+					Local.RenderLatestCompletedFrame();
+					Remote.RenderLatestCompletedFrame();
+				} while (!Worker.WaitFor(std::chrono::microseconds(100)));
+
+				Worker.Wait();
+
+				// Once the simulation thread is idle, nothing can be pending in the snapshots
+				assert(Local.RendersLatestPublishedFrame());
+				assert(Remote.RendersLatestPublishedFrame());
+			}
+			else
+			{
+				SimulateFrame();
+			}
+
+			Local.PostUpdate(TestFrameIndex, Remote);
+			Remote.PostUpdate(TestFrameIndex, Local);
+
+			// Must be "greater than" in order to make sure that the initialization packet is loaded first otherwise it might be overwritten by a regular packet
+			if (IterationIndex > (size_t)Setup.RemoteStartOffsetInFrames && IterationIndex % Environment.ReceiveRemoteIntervalInFrames == 0)
+			{
+				TEST_NSPC_Systems::TransferLocalPlayersInputs();
+			}
+
+			if (Environment.LogAllocationsPerFrame)
+			{
+				TEST_NSPC_Allocations::LogFrame(TestFrameIndex);
+			}
 		}
+
+		TeardownStart = std::chrono::steady_clock::now();
+
+		TEST_NSPC_Systems::ForceResetAndCleanup();
 	}
 
-	TEST_NSPC_Systems::ForceResetAndCleanup();
+	TEST_NSPC_Systems::RewindArenas();
+
+	const auto TeardownEnd = std::chrono::steady_clock::now();
+
+	++PhasesUsage.TestsCount;
+	PhasesUsage.SetupDuration += RunStart - SetupStart;
+	PhasesUsage.RunDuration += TeardownStart - RunStart;
+	PhasesUsage.TeardownDuration += TeardownEnd - TeardownStart;
 
 	return true;
 }
+
+void PrintSweepStatistics()
+{
+	const auto& Statistics = TEST_Player::SaveStatesUsage();
+
+	std::cout << "Save states: " << Statistics.SerializedCount << " serialized (" << Statistics.SerializedSizeInBytes << " bytes copied, " << Statistics.SharedBuffersCount << " buffers shared), " <<
+		Statistics.DeserializedCount << " deserialized, peak of " << Statistics.PeakAliveSizeInBytes << " bytes alive" << std::endl;
+
+	const auto& Rollbacks = TEST_NSPC_Systems::RollbackUsage;
+
+	// Rollbacks per new frame approximates the misprediction rate of the remote inputs
+	std::cout << "Rollbacks: " << Rollbacks.RollbacksCount << " for " << Rollbacks.NewFramesCount << " new frames (" <<
+		(Rollbacks.NewFramesCount > 0 ? 100.0 * Rollbacks.RollbacksCount / Rollbacks.NewFramesCount : 0.0) << "%), " <<
+		Rollbacks.ResimulatedFramesCount << " resimulated frames, deepest of " << Rollbacks.DeepestRollbackInFrames << " frames" << std::endl;
+
+	// Serializing every K frames only would spare (K - 1) / K of the serialization cost and memory, while every rollback would resimulate (K - 1) / 2 more frames on average
+	const double SerializationNanosecondsPerSaveState = Statistics.SerializedCount > 0 ? double(std::chrono::duration_cast<std::chrono::nanoseconds>(Statistics.SerializationDuration).count()) / Statistics.SerializedCount : 0.0;
+	const double ResimulationNanosecondsPerFrame = Rollbacks.ResimulatedFramesCount > 0 ? double(std::chrono::duration_cast<std::chrono::nanoseconds>(Rollbacks.ResimulationDuration).count()) / Rollbacks.ResimulatedFramesCount : 0.0;
+
+	std::cout << "Serialization: " << SerializationNanosecondsPerSaveState << "ns per save state, resimulation: " << ResimulationNanosecondsPerFrame << "ns per frame" << std::endl;
+	for (size_t KeyframeInterval : { 2, 4, 8 })
+	{
+		const double SparedMilliseconds = Statistics.SerializedCount * SerializationNanosecondsPerSaveState * (KeyframeInterval - 1) / KeyframeInterval / 1e6;
+		const double AddedMilliseconds = Rollbacks.RollbacksCount * ResimulationNanosecondsPerFrame * (KeyframeInterval - 1) / 2 / 1e6;
+
+		std::cout << "Keyframe every " << KeyframeInterval << " frames: " << SparedMilliseconds << "ms of serialization spared, " << AddedMilliseconds << "ms of resimulation added, peak of about " <<
+			Statistics.PeakAliveSizeInBytes / KeyframeInterval << " bytes alive" << std::endl;
+	}
+
+	const auto& Broadcast = TEST_NSPC_Systems::BroadcastUsage;
+
+	std::cout << "Inputs broadcast: " << Broadcast.ChunksCount << " chunks built (" << Broadcast.SizeInBytes << " bytes), " <<
+		Broadcast.DeliveredChunksCount << " delivered to the spectators without copy" << std::endl;
+
+	const auto TotalDuration = PhasesUsage.SetupDuration + PhasesUsage.RunDuration + PhasesUsage.TeardownDuration;
+	const auto ToPercentage = [&TotalDuration](const std::chrono::steady_clock::duration Duration)
+	{
+		return TotalDuration.count() > 0 ? 100.0 * Duration.count() / TotalDuration.count() : 0.0;
+	};
+
+	std::cout << "Phases over " << PhasesUsage.TestsCount << " tests: setup " << std::chrono::duration_cast<std::chrono::milliseconds>(PhasesUsage.SetupDuration).count() << "ms (" << ToPercentage(PhasesUsage.SetupDuration) << "%), " <<
+		"run " << std::chrono::duration_cast<std::chrono::milliseconds>(PhasesUsage.RunDuration).count() << "ms (" << ToPercentage(PhasesUsage.RunDuration) << "%), " <<
+		"teardown " << std::chrono::duration_cast<std::chrono::milliseconds>(PhasesUsage.TeardownDuration).count() << "ms (" << ToPercentage(PhasesUsage.TeardownDuration) << "%)" << std::endl;
+}
+
+void BenchmarkInputsFanOut()
+{
+	// Every client holds a replica of every player of the lobby, only the one it owns being local
+	struct MockEmulator
+	{
+		uint8_t SystemIndex = 0;
+		bool Local = false;
+
+		inline bool ShouldSendInputsToTarget(const uint8_t TargetSystemIndex) const
+		{
+			return SystemIndex != TargetSystemIndex && Local;
+		}
+	};
+
+	const size_t TransfersCount = 100;
+
+	for (size_t SystemsCount : { 2, 8, 32, 128, 255 })
+	{
+		std::vector<MockEmulator> Emulators;
+		Emulators.reserve(SystemsCount * SystemsCount);
+		for (size_t SystemIndex = 0; SystemIndex < SystemsCount; ++SystemIndex)
+		{
+			for (size_t OwnerSystemIndex = 0; OwnerSystemIndex < SystemsCount; ++OwnerSystemIndex)
+			{
+				Emulators.push_back({ uint8_t(SystemIndex), SystemIndex == OwnerSystemIndex });
+			}
+		}
+
+		TEST_RelevanceIndex<MockEmulator> InputsRelevance;
+		for (size_t SystemIndex = 0; SystemIndex < SystemsCount; ++SystemIndex)
+		{
+			InputsRelevance.AddTarget(uint8_t(SystemIndex));
+		}
+		for (const auto& Emulator : Emulators)
+		{
+			if (Emulator.Local)
+			{
+				InputsRelevance.Publish(Emulator, Emulator.SystemIndex);
+			}
+		}
+
+		// The transfers are counted so that the loops cannot be optimized away, both must find the same pairs
+		size_t ScannedTransfersCount = 0;
+		const auto ScanStart = std::chrono::steady_clock::now();
+		for (size_t TransferIndex = 0; TransferIndex < TransfersCount; ++TransferIndex)
+		{
+			for (const auto TargetSystemIndex : InputsRelevance.TargetSystemIndexes())
+			{
+				for (const auto& Emulator : Emulators)
+				{
+					ScannedTransfersCount += Emulator.ShouldSendInputsToTarget(TargetSystemIndex);
+				}
+			}
+		}
+		const auto ScanEnd = std::chrono::steady_clock::now();
+
+		size_t IndexedTransfersCount = 0;
+		const auto IndexStart = std::chrono::steady_clock::now();
+		for (size_t TransferIndex = 0; TransferIndex < TransfersCount; ++TransferIndex)
+		{
+			for (const auto TargetSystemIndex : InputsRelevance.TargetSystemIndexes())
+			{
+				for (const auto Emulator : InputsRelevance.SourcesRelevantTo(TargetSystemIndex))
+				{
+					IndexedTransfersCount += Emulator->ShouldSendInputsToTarget(TargetSystemIndex);
+				}
+			}
+		}
+		const auto IndexEnd = std::chrono::steady_clock::now();
+
+		assert(ScannedTransfersCount == IndexedTransfersCount);
+		assert(IndexedTransfersCount == TransfersCount * SystemsCount * (SystemsCount - 1));
+
+		std::cout << SystemsCount << " systems, " << Emulators.size() << " emulators, " << IndexedTransfersCount / TransfersCount << " transfers" <<
+			" - scan: " << std::chrono::duration<double, std::micro>(ScanEnd - ScanStart).count() / TransfersCount << "us" <<
+			", index: " << std::chrono::duration<double, std::micro>(IndexEnd - IndexStart).count() / TransfersCount << "us" << std::endl;
+	}
+}
\ No newline at end of file
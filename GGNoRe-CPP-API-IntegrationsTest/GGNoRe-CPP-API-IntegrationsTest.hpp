@@ -6,15 +6,26 @@
 
 #include <GGNoRe-CPP-API.hpp>
 
+#include <TEST_Allocations.hpp>
+#include <TEST_SweepPlanner.hpp>
+
 #include <array>
 #include <cassert>
-#include <functional>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 struct TestEnvironment
 {
 	size_t TestDurationInFrames = 60;
 	uint16_t ReceiveRemoteIntervalInFrames = 3;
+	bool LogAllocationsPerFrame = false;
+	// 0 disables the check, otherwise the module must not allocate anymore once the test ran for that many frames
+	size_t ZeroAllocationWarmupInFrames = 0;
+	// Simulates on a worker thread while the main thread renders the latest completed frame
+	bool PipelinedRendering = false;
+	// Read the broadcast stream of the inputs, none unless asked for so that the sweep only pays for the broadcast when measuring it
+	uint16_t SpectatorsCount = 0;
 };
 
 struct PlayersSetup
@@ -25,35 +36,89 @@ struct PlayersSetup
 	float RemoteMockHardwareFrameDurationInSeconds = 0.016667f;
 };
 
-struct RangeFunctorChain
+// True for the configurations that Test1Local1RemoteMockRollback does not run, so that the sweep can prune them before loading the configuration
+bool ShouldSkipTest(const GGNoRe::API::DATA_CFG Config, const TestEnvironment Environment, const PlayersSetup Setup);
+bool Test1Local1RemoteMockRollback(const GGNoRe::API::DATA_CFG Config, const TestEnvironment Environment, const PlayersSetup Setup);
+void PrintSweepStatistics();
+void BenchmarkInputsFanOut();
+
+// Without argument every configuration is tested, which takes hours and is meant for nightly runs
+// --pairwise or --3-wise only test enough configurations to cover every combination of values of any 2 or 3 parameters, which is meant for quick runs before merging
+// --log-allocations logs the heap allocations of every frame by subsystem, only available when built with GGNORECPPAPI_TEST_ALLOCATIONS
+// --zero-allocation asserts that the module does not allocate between PreSimulation and PostSimulation once warmed up, only available when built with GGNORECPPAPI_TEST_ALLOCATIONS
+// --pipelined overlaps the simulation with the rendering of the latest completed frame, not combinable with the allocation flags
+// --spectators N broadcasts the inputs to N spectators, the first one replaying the stream to check that no frame is missing or repeated
+// --benchmark-fan-out only compares the cost of the inputs transfer with and without the relevance index in large lobbies
+int main(int ArgumentsCount, char* Arguments[])
 {
-	size_t GlobalTestCount = 1;
-	std::function<void()> RangeFunctor;
-};
+	GGNoRe::API::DATA_CFG Config;
+	TestEnvironment Environment;
+	PlayersSetup Setup;
 
-template<typename T, std::size_t N> RangeFunctorChain GetRangeFunctor(const std::array<T, N> ValueRange, T& Value, const RangeFunctorChain ChainedRangeFunctor) noexcept
-{
-	return
+	auto Coverage = TEST_SweepPlanner::Coverage_E::Exhaustive;
+	for (int ArgumentIndex = 1; ArgumentIndex < ArgumentsCount; ++ArgumentIndex)
 	{
-		ChainedRangeFunctor.GlobalTestCount * N,
-		[ValueRange, &Value, ChainedRangeFunctor]()
+		if (std::strcmp(Arguments[ArgumentIndex], "--pairwise") == 0)
+		{
+			Coverage = TEST_SweepPlanner::Coverage_E::Pairwise;
+		}
+		else if (std::strcmp(Arguments[ArgumentIndex], "--3-wise") == 0)
+		{
+			Coverage = TEST_SweepPlanner::Coverage_E::ThreeWise;
+		}
+		else if (std::strcmp(Arguments[ArgumentIndex], "--exhaustive") == 0)
 		{
-			for (const auto& NewValue : ValueRange)
+			Coverage = TEST_SweepPlanner::Coverage_E::Exhaustive;
+		}
+		else if (std::strcmp(Arguments[ArgumentIndex], "--log-allocations") == 0)
+		{
+			Environment.LogAllocationsPerFrame = true;
+		}
+		else if (std::strcmp(Arguments[ArgumentIndex], "--pipelined") == 0)
+		{
+			Environment.PipelinedRendering = true;
+		}
+		else if (std::strcmp(Arguments[ArgumentIndex], "--spectators") == 0 && ArgumentIndex + 1 < ArgumentsCount)
+		{
+			char* CountEnd = nullptr;
+			const auto Count = std::strtoul(Arguments[++ArgumentIndex], &CountEnd, 10);
+			if (CountEnd == Arguments[ArgumentIndex] || *CountEnd != '\0' || Count > UINT16_MAX)
 			{
-				Value = NewValue;
-				ChainedRangeFunctor.RangeFunctor();
+				std::cout << "Invalid spectators count " << Arguments[ArgumentIndex] << ", expected an integer between 0 and " << UINT16_MAX << std::endl;
+				return 1;
 			}
+
+			Environment.SpectatorsCount = uint16_t(Count);
 		}
-	};
-}
+		else if (std::strcmp(Arguments[ArgumentIndex], "--benchmark-fan-out") == 0)
+		{
+			BenchmarkInputsFanOut();
+			return 0;
+		}
+		else if (std::strcmp(Arguments[ArgumentIndex], "--zero-allocation") == 0)
+		{
+			// Past the latest remote start and the largest rollback window, so that every buffer had the time to reach its full size
+			Environment.ZeroAllocationWarmupInFrames = 30;
+		}
+		else
+		{
+			std::cout << "Unknown argument " << Arguments[ArgumentIndex] << ", expected --exhaustive, --pairwise, --3-wise, --log-allocations, --zero-allocation, --pipelined, --spectators N or --benchmark-fan-out" << std::endl;
+			return 1;
+		}
+	}
 
-bool Test1Local1RemoteMockRollback(const GGNoRe::API::DATA_CFG Config, const TestEnvironment Environment, const PlayersSetup Setup);
+	if (!TEST_NSPC_Allocations::Enabled && (Environment.LogAllocationsPerFrame || Environment.ZeroAllocationWarmupInFrames > 0))
+	{
+		std::cout << "--log-allocations and --zero-allocation require building with GGNORECPPAPI_TEST_ALLOCATIONS" << std::endl;
+		return 1;
+	}
 
-int main()
-{
-	GGNoRe::API::DATA_CFG Config;
-	TestEnvironment Environment;
-	PlayersSetup Setup;
+	// The allocation counters are plain integers owned by the main thread, the simulation thread of the pipelining would race on them
+	if (Environment.PipelinedRendering && (Environment.LogAllocationsPerFrame || Environment.ZeroAllocationWarmupInFrames > 0))
+	{
+		std::cout << "--pipelined cannot be combined with --log-allocations or --zero-allocation" << std::endl;
+		return 1;
+	}
 
 	GGNoRe::API::ABS_DBG_HumanReadable::LoggingLevel = GGNoRe::API::ABS_DBG_HumanReadable::LoggingLevel_E::Dump;
 
@@ -63,41 +128,50 @@ int main()
 		const size_t StartTestIndex = 1; // Run the sln in development mode for optimal speed while keeping asserts, then if an assert is hit start from the failing test and run in debug mode
 	};
 	TestProgress Progress;
-	RangeFunctorChain Tests;
-	const RangeFunctorChain TestRunner
-	{
-		1,
-		[&Config, &Environment, &Setup, &Tests, &Progress]()
+	// The first parameter is the innermost loop of the exhaustive sweep
+	const TEST_SweepPlanner Planner
+	(
+		{
+			GetSweepParameter(std::array<size_t, 4>{ 0, 1, 2, 3 }, Config.RollbackConfiguration.DelayFramesCount),
+			GetSweepParameter(std::array<size_t, 4>{ 0, 1, 2, 3 }, Config.RollbackConfiguration.InputLeniencyFramesCount),
+			GetSweepParameter(std::array<size_t, 3>{ 1, 4, 7 }, Config.RollbackConfiguration.MinRollbackFrameCount),
+			GetSweepParameter(std::array<bool, 1>{ false }, Config.RollbackConfiguration.ForceMaximumRollback),
+
+			// 144hz, 60hz, 45hz, 30hz
+			GetSweepParameter(std::array<GGNoRe::API::SER_FixedPoint, 4>{ 0.006944f, 0.016667f, 0.022222f, 0.033333f }, Config.SimulationConfiguration.FrameDurationInSeconds),
+			GetSweepParameter(std::array<GGNoRe::API::SER_FixedPoint, 2>{ 0.f, 60.f * 0.016667f }, Config.SimulationConfiguration.StallTimerDurationInSeconds),
+			GetSweepParameter(std::array<GGNoRe::API::SER_FixedPoint, 2>{ 0.f, 60.f * 0.016667f }, Config.SimulationConfiguration.DoubleSimulationTimerDurationInSeconds),
+
+			GetSweepParameter(std::array<uint16_t, 3>{ 1, 2, 5 }, Environment.ReceiveRemoteIntervalInFrames),
+
+			GetSweepParameter(std::array<uint16_t, 3>{ 0, 1, 10 }, Setup.LocalStartFrameIndex),
+			GetSweepParameter(std::array<uint16_t, 3>{ 0, 2, 5 }, Setup.RemoteStartOffsetInFrames),
+			// 90fps, 60fps, 30fps
+			GetSweepParameter(std::array<float, 3>{ 0.011111f, 0.016667f, 0.033333f }, Setup.LocalMockHardwareFrameDurationInSeconds),
+			// 120fps, 60fps, 40fps, 16fps
+			GetSweepParameter(std::array<float, 4>{ 0.008333f, 0.016667f, 0.025f, 0.0625f }, Setup.RemoteMockHardwareFrameDurationInSeconds)
+		},
+		[&Config, &Environment, &Setup]()
+		{
+			return ShouldSkipTest(Config, Environment, Setup);
+		}
+	);
+
+	Planner.Run
+	(
+		Coverage,
+		[&Config, &Environment, &Setup, &Progress](const size_t TestIndex, const size_t TestsCount)
 		{
-			++Progress.CurrentTestCounter;
+			Progress.CurrentTestCounter = TestIndex;
 			if (Progress.CurrentTestCounter >= Progress.StartTestIndex)
 			{
 				assert(Test1Local1RemoteMockRollback(Config, Environment, Setup));
-				std::cout << std::to_string(Progress.CurrentTestCounter) << "/" << Tests.GlobalTestCount << std::endl;
+				std::cout << std::to_string(Progress.CurrentTestCounter) << "/" << TestsCount << std::endl;
 			}
 		}
-	};
-
-	Tests = GetRangeFunctor(std::array<size_t, 4>{ 0, 1, 2, 3 }, Config.RollbackConfiguration.DelayFramesCount, TestRunner);
-	Tests = GetRangeFunctor(std::array<size_t, 4>{ 0, 1, 2, 3 }, Config.RollbackConfiguration.InputLeniencyFramesCount, Tests);
-	Tests = GetRangeFunctor(std::array<size_t, 3>{ 1, 4, 7 }, Config.RollbackConfiguration.MinRollbackFrameCount, Tests);
-	Tests = GetRangeFunctor(std::array<bool, 1>{ false }, Config.RollbackConfiguration.ForceMaximumRollback, Tests);
-
-	// 144hz, 60hz, 45hz, 30hz
-	Tests = GetRangeFunctor(std::array<GGNoRe::API::SER_FixedPoint, 4>{ 0.006944f, 0.016667f, 0.022222f, 0.033333f }, Config.SimulationConfiguration.FrameDurationInSeconds, Tests);
-	Tests = GetRangeFunctor(std::array<GGNoRe::API::SER_FixedPoint, 2>{ 0.f, 60.f * 0.016667f }, Config.SimulationConfiguration.StallTimerDurationInSeconds, Tests);
-	Tests = GetRangeFunctor(std::array<GGNoRe::API::SER_FixedPoint, 2>{ 0.f, 60.f * 0.016667f }, Config.SimulationConfiguration.DoubleSimulationTimerDurationInSeconds, Tests);
-
-	Tests = GetRangeFunctor(std::array<uint16_t, 3>{ 1, 2, 5 }, Environment.ReceiveRemoteIntervalInFrames, Tests);
-
-	Tests = GetRangeFunctor(std::array<uint16_t, 3>{ 0, 1, 10 }, Setup.LocalStartFrameIndex, Tests);
-	Tests = GetRangeFunctor(std::array<uint16_t, 3>{ 0, 2, 5 }, Setup.RemoteStartOffsetInFrames, Tests);
-	// 90fps, 60fps, 30fps
-	Tests = GetRangeFunctor(std::array<float, 3>{ 0.011111f, 0.016667f, 0.033333f }, Setup.LocalMockHardwareFrameDurationInSeconds, Tests);
-	// 120fps, 60fps, 40fps, 16fps
-	Tests = GetRangeFunctor(std::array<float, 4>{ 0.008333f, 0.016667f, 0.025f, 0.0625f }, Setup.RemoteMockHardwareFrameDurationInSeconds, Tests);
+	);
 
-	Tests.RangeFunctor();
+	PrintSweepStatistics();
 
 	return 0;
 }
\ No newline at end of file
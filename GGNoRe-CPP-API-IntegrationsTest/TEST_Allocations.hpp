@@ -0,0 +1,177 @@
+/*
+ * Copyright 2022 Loic Venerosy
+ */
+
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+// Replaces the global allocation functions in order to attribute every heap allocation to the subsystem being called at the time
+// The module claims that its heap usage is bounded by the configuration, so once warmed up it should not allocate at all
+// Only compiled in with GGNORECPPAPI_TEST_ALLOCATIONS so that the other runs do not pay for the accounting on every allocation, the counters stay at 0 otherwise
+// The calls to the module entry points are scoped to their subsystem, and the user callbacks they invoke scope themselves back to User whenever they may allocate
+#if defined(GGNORECPPAPI_TEST_ALLOCATIONS) && defined(GGNORECPPAPI_LOG)
+#error The log strings built by the module would be attributed to its subsystems, build GGNORECPPAPI_TEST_ALLOCATIONS without GGNORECPPAPI_LOG
+#endif
+
+namespace TEST_NSPC_Allocations
+{
+#ifdef GGNORECPPAPI_TEST_ALLOCATIONS
+	constexpr bool Enabled = true;
+#else
+	constexpr bool Enabled = false;
+#endif
+
+	enum class Subsystem_E : uint8_t
+	{
+		User = 0, // The tests themselves, as well as the gameplay code they run such as spawning fireballs
+		Emulator,
+		Rollback,
+		Simulator,
+		SaveStates, // The user serialization, which the module leaves up to you to optimize with the containers of your engine
+		ActivationJournal,
+		Count
+	};
+
+	constexpr std::array<const char*, (size_t)Subsystem_E::Count> SubsystemNames{ "User", "Emulator", "Rollback", "Simulator", "SaveStates", "ActivationJournal" };
+
+	struct Counters
+	{
+		size_t AllocationsCount = 0;
+		size_t AllocatedSizeInBytes = 0;
+		size_t AliveSizeInBytes = 0;
+		// Since the previous LogFrame
+		size_t FramePeakAliveSizeInBytes = 0;
+	};
+
+	// Plain data only, so that it is ready before any static initialization allocates
+	std::array<Counters, (size_t)Subsystem_E::Count> SubsystemCounters;
+	std::array<Counters, (size_t)Subsystem_E::Count> LatestLoggedSubsystemCounters;
+
+	thread_local Subsystem_E CurrentSubsystem = Subsystem_E::User;
+
+	struct AllocationHeader
+	{
+		size_t SizeInBytes;
+		Subsystem_E Subsystem;
+	};
+
+	// Keeps the returned address aligned like the one from malloc
+	constexpr size_t HeaderSizeInBytes = (sizeof(AllocationHeader) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+	// Attributes the allocations to a subsystem until going out of scope, nested scopes take precedence
+	class Scope final
+	{
+		const Subsystem_E PreviousSubsystem;
+
+	public:
+		explicit Scope(const Subsystem_E Subsystem)
+			:PreviousSubsystem(CurrentSubsystem)
+		{
+			assert(Subsystem < Subsystem_E::Count);
+
+			CurrentSubsystem = Subsystem;
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		~Scope()
+		{
+			CurrentSubsystem = PreviousSubsystem;
+		}
+	};
+
+	inline const Counters& Get(const Subsystem_E Subsystem)
+	{
+		return SubsystemCounters[(size_t)Subsystem];
+	}
+
+	// Only the subsystems belonging to the module, the user code is free to allocate
+	inline size_t ModuleAllocationsCount()
+	{
+		return
+			Get(Subsystem_E::Emulator).AllocationsCount +
+			Get(Subsystem_E::Rollback).AllocationsCount +
+			Get(Subsystem_E::Simulator).AllocationsCount +
+			Get(Subsystem_E::ActivationJournal).AllocationsCount;
+	}
+
+	// Logs what was allocated since the previous call, along with the memory currently in use and its peak over the frame
+	void LogFrame(const uint16_t FrameIndex)
+	{
+		auto CountersToLog = SubsystemCounters;
+
+		std::cout << "############ ALLOCATIONS - FRAME " << std::to_string(FrameIndex) << " ############\n";
+		for (size_t SubsystemIndex = 0; SubsystemIndex < CountersToLog.size(); ++SubsystemIndex)
+		{
+			std::cout << SubsystemNames[SubsystemIndex] <<
+				": " << CountersToLog[SubsystemIndex].AllocationsCount - LatestLoggedSubsystemCounters[SubsystemIndex].AllocationsCount << " allocations" <<
+				", " << CountersToLog[SubsystemIndex].AllocatedSizeInBytes - LatestLoggedSubsystemCounters[SubsystemIndex].AllocatedSizeInBytes << " bytes" <<
+				", " << CountersToLog[SubsystemIndex].AliveSizeInBytes << " bytes alive" <<
+				", peak of " << CountersToLog[SubsystemIndex].FramePeakAliveSizeInBytes << " bytes this frame\n";
+		}
+		std::cout << std::endl;
+
+		// Taken after logging so that the logging allocations are not attributed to the next frame
+		LatestLoggedSubsystemCounters = SubsystemCounters;
+
+		for (auto& Counters : SubsystemCounters)
+		{
+			Counters.FramePeakAliveSizeInBytes = Counters.AliveSizeInBytes;
+		}
+	}
+}
+
+#ifdef GGNORECPPAPI_TEST_ALLOCATIONS
+void* operator new(std::size_t SizeInBytes)
+{
+	auto* Block = static_cast<uint8_t*>(std::malloc(TEST_NSPC_Allocations::HeaderSizeInBytes + SizeInBytes));
+	if (Block == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+
+	new (Block) TEST_NSPC_Allocations::AllocationHeader{ SizeInBytes, TEST_NSPC_Allocations::CurrentSubsystem };
+
+	auto& Counters = TEST_NSPC_Allocations::SubsystemCounters[(size_t)TEST_NSPC_Allocations::CurrentSubsystem];
+	++Counters.AllocationsCount;
+	Counters.AllocatedSizeInBytes += SizeInBytes;
+	Counters.AliveSizeInBytes += SizeInBytes;
+	if (Counters.AliveSizeInBytes > Counters.FramePeakAliveSizeInBytes)
+	{
+		Counters.FramePeakAliveSizeInBytes = Counters.AliveSizeInBytes;
+	}
+
+	return Block + TEST_NSPC_Allocations::HeaderSizeInBytes;
+}
+
+// The array and nothrow versions of the global allocation functions forward to these by default
+void operator delete(void* Pointer) noexcept
+{
+	if (Pointer == nullptr)
+	{
+		return;
+	}
+
+	auto* Block = static_cast<uint8_t*>(Pointer) - TEST_NSPC_Allocations::HeaderSizeInBytes;
+	const auto* Header = reinterpret_cast<const TEST_NSPC_Allocations::AllocationHeader*>(Block);
+
+	// Freed memory is attributed to the subsystem that allocated it
+	TEST_NSPC_Allocations::SubsystemCounters[(size_t)Header->Subsystem].AliveSizeInBytes -= Header->SizeInBytes;
+
+	std::free(Block);
+}
+
+void operator delete(void* Pointer, std::size_t) noexcept
+{
+	operator delete(Pointer);
+}
+#endif
\ No newline at end of file
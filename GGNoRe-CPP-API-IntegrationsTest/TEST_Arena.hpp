@@ -0,0 +1,178 @@
+/*
+ * Copyright 2022 Loic Venerosy
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+// Arena for the memory of a single match, with a free list per slot size
+// Allocating reuses a slot of the same size freed earlier, or bumps an offset inside big blocks otherwise, so the memory held follows the peak of what is alive instead of growing with the length of the match
+// For the save states, what is alive is bounded by the rollback window
+// The whole match is released at once by rewinding or destroying the arena, everything allocated from it must be destroyed before rewinding
+class TEST_Arena final
+{
+	// Every slot is aligned the same way so that any freed slot can be reused whatever the alignment asked for
+	static constexpr size_t SlotAlignment = alignof(std::max_align_t);
+
+	struct Block
+	{
+		std::unique_ptr<uint8_t[]> Memory;
+		size_t SizeInBytes = 0;
+	};
+
+	// Written inside the freed slots themselves
+	struct FreeSlot
+	{
+		FreeSlot* Next = nullptr;
+	};
+
+	const size_t BlockSizeInBytes;
+
+	std::vector<Block> Blocks;
+	size_t CurrentBlockIndex = 0;
+	size_t CurrentOffsetInBytes = 0;
+
+	// Indexed by the size of the slots in multiples of SlotAlignment
+	std::vector<FreeSlot*> SizeClassToFreeSlots;
+
+	static inline size_t SizeClass(const size_t SizeInBytes)
+	{
+		return (std::max(SizeInBytes, sizeof(FreeSlot)) + SlotAlignment - 1) / SlotAlignment;
+	}
+
+	void* Bump(const size_t SlotSizeInBytes)
+	{
+		while (CurrentBlockIndex < Blocks.size())
+		{
+			if (CurrentOffsetInBytes + SlotSizeInBytes <= Blocks[CurrentBlockIndex].SizeInBytes)
+			{
+				void* Slot = Blocks[CurrentBlockIndex].Memory.get() + CurrentOffsetInBytes;
+				CurrentOffsetInBytes += SlotSizeInBytes;
+				return Slot;
+			}
+
+			// The end of the block is wasted, fine as long as the blocks are big compared to the allocations
+			++CurrentBlockIndex;
+			CurrentOffsetInBytes = 0;
+		}
+
+		// Oversized allocations get a block of their own
+		const size_t NewBlockSizeInBytes = SlotSizeInBytes > BlockSizeInBytes ? SlotSizeInBytes : BlockSizeInBytes;
+		Blocks.push_back({ std::unique_ptr<uint8_t[]>(new uint8_t[NewBlockSizeInBytes]), NewBlockSizeInBytes });
+
+		CurrentBlockIndex = Blocks.size() - 1;
+		CurrentOffsetInBytes = SlotSizeInBytes;
+
+		return Blocks[CurrentBlockIndex].Memory.get();
+	}
+
+public:
+	explicit TEST_Arena(const size_t BlockSizeInBytes = 16 * 1024)
+		:BlockSizeInBytes((BlockSizeInBytes + SlotAlignment - 1) / SlotAlignment * SlotAlignment)
+	{
+		assert(BlockSizeInBytes > 0);
+	}
+
+	TEST_Arena(const TEST_Arena&) = delete;
+	TEST_Arena& operator=(const TEST_Arena&) = delete;
+
+	~TEST_Arena() = default;
+
+	void* Allocate(const size_t SizeInBytes, const size_t Alignment)
+	{
+		assert(Alignment > 0 && (Alignment & (Alignment - 1)) == 0);
+		assert(Alignment <= SlotAlignment);
+
+		const size_t SlotSizeClass = SizeClass(SizeInBytes);
+		if (SlotSizeClass >= SizeClassToFreeSlots.size())
+		{
+			// Here rather than when deallocating, which must not throw
+			SizeClassToFreeSlots.resize(SlotSizeClass + 1, nullptr);
+		}
+
+		auto*& FreeSlots = SizeClassToFreeSlots[SlotSizeClass];
+		if (FreeSlots != nullptr)
+		{
+			FreeSlot* Slot = FreeSlots;
+			FreeSlots = Slot->Next;
+			return Slot;
+		}
+
+		return Bump(SlotSizeClass * SlotAlignment);
+	}
+
+	void Deallocate(void* Slot, const size_t SizeInBytes) noexcept
+	{
+		const size_t SlotSizeClass = SizeClass(SizeInBytes);
+		assert(SlotSizeClass < SizeClassToFreeSlots.size());
+
+		auto*& FreeSlots = SizeClassToFreeSlots[SlotSizeClass];
+		FreeSlots = new (Slot) FreeSlot{ FreeSlots };
+	}
+
+	// O(1) release of everything allocated so far, apart from forgetting the free slots, the blocks are kept so that the next match does not go through the heap again
+	void Rewind()
+	{
+		CurrentBlockIndex = 0;
+		CurrentOffsetInBytes = 0;
+		std::fill(SizeClassToFreeSlots.begin(), SizeClassToFreeSlots.end(), nullptr);
+	}
+
+	size_t CapacityInBytes() const
+	{
+		size_t CapacityInBytes = 0;
+		for (const auto& CurrentBlock : Blocks)
+		{
+			CapacityInBytes += CurrentBlock.SizeInBytes;
+		}
+
+		return CapacityInBytes;
+	}
+};
+
+// Standard allocator interface on top of the arena, for the STL containers and std::allocate_shared
+// Not final since the STL implementations may derive from the allocator for the empty base optimization
+template<typename T> class TEST_ArenaAllocator
+{
+	template<typename U> friend class TEST_ArenaAllocator;
+
+	TEST_Arena* Arena;
+
+public:
+	using value_type = T;
+
+	explicit TEST_ArenaAllocator(TEST_Arena& Arena) noexcept
+		:Arena(&Arena)
+	{}
+
+	template<typename U> TEST_ArenaAllocator(const TEST_ArenaAllocator<U>& Other) noexcept
+		:Arena(Other.Arena)
+	{}
+
+	T* allocate(const size_t Count)
+	{
+		return static_cast<T*>(Arena->Allocate(Count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* Pointer, const size_t Count) noexcept
+	{
+		Arena->Deallocate(Pointer, Count * sizeof(T));
+	}
+
+	template<typename U> bool operator==(const TEST_ArenaAllocator<U>& Other) const noexcept
+	{
+		return Arena == Other.Arena;
+	}
+
+	template<typename U> bool operator!=(const TEST_ArenaAllocator<U>& Other) const noexcept
+	{
+		return Arena != Other.Arena;
+	}
+};
\ No newline at end of file
@@ -6,6 +6,8 @@
 
 #include <GGNoRe-CPP-API.hpp>
 
+#include <TEST_Allocations.hpp>
+
 #include <cassert>
 #ifdef GGNORECPPAPI_LOG
 #include <iostream>
@@ -42,6 +44,8 @@ class TEST_Fireball final
 		{
 			assert(PublicSelf != nullptr);
 
+			// Registering a component spawned mid-match is module work, so it is up to the module to have room for it once warmed up
+			TEST_NSPC_Allocations::Scope ActivationScope(TEST_NSPC_Allocations::Subsystem_E::ActivationJournal);
 			ChangeActivationNow(Owner, ActivationChangeEvent::ChangeType_E::Activate);
 		}
 
@@ -72,12 +76,15 @@ class TEST_Fireball final
 
 		void OnSimulateFrame(const uint16_t SimulatedFrameIndex, const std::set<uint8_t>& Inputs) override
 		{
+			TEST_NSPC_Allocations::Scope UserScope(TEST_NSPC_Allocations::Subsystem_E::User);
+
 			assert(SimulatedFrameIndex >= StartFrameIndex);
 
 			const uint16_t LifetimeInFrames = 2;
 			assert(SimulatedFrameIndex <= LifetimeInFrames + StartFrameIndex);
 			if (SimulatedFrameIndex == LifetimeInFrames + StartFrameIndex)
 			{
+				TEST_NSPC_Allocations::Scope ActivationScope(TEST_NSPC_Allocations::Subsystem_E::ActivationJournal);
 				ChangeActivationNow(OwnerAtFrame(SimulatedFrameIndex), ActivationChangeEvent::ChangeType_E::Deactivate);
 			}
 		}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2022 Loic Venerosy
+ */
+
+#pragma once
+
+#include <GGNoRe-CPP-API.hpp>
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Append-only stream of the inputs packets of a session, built once and read by every spectator
+// The packets are stored as immutable chunks shared with the spectators, so a spectator only costs a cursor instead of a download per player
+class TEST_InputsBroadcast final
+{
+public:
+	struct Chunk
+	{
+		GGNoRe::API::id_t PlayerId = 0;
+		// The frame the packet was uploaded at, which orders the chunks of a player
+		uint16_t FrameIndex = 0;
+		std::shared_ptr<const std::vector<uint8_t>> BinaryPacket;
+	};
+
+private:
+	std::vector<Chunk> Chunks;
+	// Index of the first chunk not delivered yet, per spectator
+	std::vector<size_t> SpectatorCursors;
+
+public:
+	TEST_InputsBroadcast() = default;
+
+	TEST_InputsBroadcast(const TEST_InputsBroadcast&) = delete;
+	TEST_InputsBroadcast& operator=(const TEST_InputsBroadcast&) = delete;
+
+	~TEST_InputsBroadcast() = default;
+
+	inline size_t ChunksCount() const
+	{
+		return Chunks.size();
+	}
+
+	inline size_t SpectatorsCount() const
+	{
+		return SpectatorCursors.size();
+	}
+
+	// The packet is shared as is, appending does not copy it
+	void Append(const GGNoRe::API::id_t PlayerId, const uint16_t FrameIndex, const std::shared_ptr<const std::vector<uint8_t>>& BinaryPacket)
+	{
+		assert(BinaryPacket && !BinaryPacket->empty());
+
+		Chunks.push_back({ PlayerId, FrameIndex, BinaryPacket });
+	}
+
+	// A spectator joining late starts from the beginning of the stream so that it can catch up by itself
+	size_t AddSpectator()
+	{
+		SpectatorCursors.push_back(0);
+		return SpectatorCursors.size() - 1;
+	}
+
+	// Calls the functor with every chunk appended since the previous delivery to this spectator, in the order they were appended, the chunk must be copied to be kept
+	template<typename FunctorT> void Deliver(const size_t SpectatorIndex, FunctorT&& Consume)
+	{
+		assert(SpectatorIndex < SpectatorCursors.size());
+
+		auto& Cursor = SpectatorCursors[SpectatorIndex];
+		for (; Cursor < Chunks.size(); ++Cursor)
+		{
+			Consume(Chunks[Cursor]);
+		}
+	}
+
+	void Clear()
+	{
+		Chunks.clear();
+		SpectatorCursors.clear();
+	}
+};
\ No newline at end of file
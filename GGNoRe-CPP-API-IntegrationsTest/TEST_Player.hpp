@@ -5,11 +5,16 @@
 #pragma once
 
 #include <Input/CPT_IPT_TogglesPacket.hpp>
+#include <TEST_Arena.hpp>
 #include <TEST_Fireball.hpp>
+#include <TEST_RelevanceIndex.hpp>
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstring>
 #include <map>
+#include <memory>
 #include <set>
 
 namespace TEST_NSPC_Systems
@@ -26,7 +31,7 @@ namespace TEST_NSPC_Systems
 	};
 }
 
-// This is a player class grouping the 3 components for simplicity's sake
+// This is a player class grouping the components for simplicity's sake, one of each kind plus a second save states component for the part of the state that rarely changes
 // In your game it could be a fireball with only save states and a simulator, or a player input controller with only an emulator
 class TEST_Player final
 {
@@ -48,15 +53,49 @@ public:
 		using SerializableState = GGNoRe::API::CPT_SER_Tuple_TEMP<uint16_t, uint8_t, int64_t, bool>;
 		SerializableState State;
 
+		// Unlike the accumulators above, only modified when casting a fireball so it stays the same for most frames
+		// Serialized by its own component in order to test the save states sharing their buffer
+		enum CastsKeys_E : size_t
+		{
+			CastsNonZero = 0, // Same as NonZero
+			FireballsCastCount
+		};
+
+		using SerializableCasts = GGNoRe::API::CPT_SER_Tuple_TEMP<uint16_t, uint16_t>;
+		SerializableCasts Casts;
+
 		TEST_CPT_State()
 		{
 			std::get<StateKeys_E::NonZero>(State.Values()) = 1;
 			std::get<StateKeys_E::InputsAccumulator>(State.Values()) = 0;
 			std::get<StateKeys_E::DeltaDurationAccumulatorInSeconds>(State.Values()) = 0;
 			std::get<StateKeys_E::PrimedForFireball>(State.Values()) = false;
+
+			std::get<CastsKeys_E::CastsNonZero>(Casts.Values()) = 1;
+			std::get<CastsKeys_E::FireballsCastCount>(Casts.Values()) = 0;
 		}
 	};
 
+	// Most save states are never deserialized since only the frames preceding a misprediction are rolled back to
+	// Those numbers give the serialization cost that sparser save states would spare, against the resimulation they would add
+	struct SaveStatesStatistics
+	{
+		size_t SerializedCount = 0;
+		size_t SerializedSizeInBytes = 0;
+		size_t SharedBuffersCount = 0; // Serializations reusing the buffer of the previous save state, which only spares the copy and the memory since the state is still uploaded to compare it
+		size_t DeserializedCount = 0;
+		size_t AliveSizeInBytes = 0;
+		size_t PeakAliveSizeInBytes = 0;
+		std::chrono::steady_clock::duration SerializationDuration{};
+	};
+
+	// Every packet uploaded by a local emulator, kept for the spectators until the next transfer
+	struct UploadedInputs
+	{
+		uint16_t FrameIndex = 0; // Of the owner's system at the time of the upload
+		std::shared_ptr<const std::vector<uint8_t>> BinaryPacket;
+	};
+
 private:
 	class TEST_CPT_IPT_Emulator final : public GGNoRe::API::ABS_CPT_IPT_Emulator
 	{
@@ -86,7 +125,10 @@ private:
 			return CurrentOwnership.Owner.SystemIndex != TargetSystemIndex && CurrentOwnership.Owner.Local;
 		}
 
-		~TEST_CPT_IPT_Emulator() = default;
+		~TEST_CPT_IPT_Emulator()
+		{
+			InputsRelevanceInternal.Unpublish(*this);
+		}
 
 	protected:
 		void OnRegisterActivationChange(const RegisterActivationChangeEvent RegisteredActivationChange, const ActivationChangeEvent ActivationChange) override
@@ -105,6 +147,18 @@ private:
 					}
 
 					CurrentOwnership = { ActivationChange.Owner, ActivationChange.FrameIndex };
+
+					// Called from within the registration of the activation change, but the index belongs to the tests and not to the module
+					TEST_NSPC_Allocations::Scope UserScope(TEST_NSPC_Allocations::Subsystem_E::User);
+
+					if (CurrentOwnership.Owner.Local)
+					{
+						InputsRelevanceInternal.Publish(*this, CurrentOwnership.Owner.SystemIndex);
+					}
+					else
+					{
+						InputsRelevanceInternal.Unpublish(*this);
+					}
 				}
 			}
 			else
@@ -139,34 +193,73 @@ private:
 
 		void OnReadyToUploadInputs(const std::vector<uint8_t>& BinaryPacket) override
 		{
+			TEST_NSPC_Allocations::Scope UserScope(TEST_NSPC_Allocations::Subsystem_E::User);
+
 			Inputs = BinaryPacket;
+
+			if (RecordsUploadsInternal)
+			{
+				PlayerIdToUploadsInternal[CurrentOwnership.Owner.Id].push_back({
+					GGNoRe::API::SystemMultiton::GetRollbackable(CurrentOwnership.Owner.SystemIndex).UnsimulatedFrameIndex(),
+					std::make_shared<const std::vector<uint8_t>>(BinaryPacket)
+				});
+			}
 		}
 
 		void ResetAndCleanup() noexcept override
 		{
 			Inputs.clear();
+
+			InputsRelevanceInternal.Unpublish(*this);
 		}
 	};
 
-	class TEST_CPT_RB_SaveStates final : public GGNoRe::API::ABS_CPT_RB_SaveStates
+	// Serializes one part of the state of the player, the parts left unchanged by a frame then share their save states
+	template<typename SerializableT> class TEST_CPT_RB_SaveStates final : public GGNoRe::API::ABS_CPT_RB_SaveStates
 	{
+		// Both the buffer and its reference count live in the arena of the match instead of the global heap
+		struct SharedBinary
+		{
+			const std::vector<uint8_t, TEST_ArenaAllocator<uint8_t>> Buffer;
+
+			SharedBinary(const std::vector<uint8_t>& CurrentPlayerStateBuffer, TEST_Arena& Arena)
+				:Buffer(CurrentPlayerStateBuffer.cbegin(), CurrentPlayerStateBuffer.cend(), TEST_ArenaAllocator<uint8_t>(Arena))
+			{
+				SaveStatesStatisticsInternal.AliveSizeInBytes += Buffer.size();
+				SaveStatesStatisticsInternal.PeakAliveSizeInBytes = std::max(SaveStatesStatisticsInternal.PeakAliveSizeInBytes, SaveStatesStatisticsInternal.AliveSizeInBytes);
+			}
+
+			~SharedBinary()
+			{
+				SaveStatesStatisticsInternal.AliveSizeInBytes -= Buffer.size();
+			}
+		};
+
+		// A part of the state left untouched produces the same binary frame after frame, like the casts of a player who did not cast anything, so consecutive save states with identical content share the same buffer
 		class SaveState final : public ABS_SaveState
 		{
-			const std::vector<uint8_t> BinaryBuffer;
+			const std::shared_ptr<const SharedBinary> BinaryBuffer;
 
 		public:
-			SaveState(const std::vector<uint8_t>& CurrentPlayerStateBuffer)
+			SaveState(const std::shared_ptr<const SharedBinary>& CurrentPlayerStateBuffer)
 				:BinaryBuffer(CurrentPlayerStateBuffer)
-			{}
+			{
+				assert(BinaryBuffer);
+			}
+
+			inline const std::shared_ptr<const SharedBinary>& Shared() const
+			{
+				return BinaryBuffer;
+			}
 
 			const uint8_t* Binary() const override
 			{
-				return BinaryBuffer.data();
+				return BinaryBuffer->Buffer.data();
 			}
 
 			size_t Size() const override
 			{
-				return BinaryBuffer.size();
+				return BinaryBuffer->Buffer.size();
 			}
 
 			~SaveState()
@@ -175,13 +268,42 @@ private:
 			}
 		};
 
-		TEST_CPT_State& PlayerState;
+		SerializableT& SerializedState;
+		TEST_Arena& Arena;
 		// The id is stored here for logging purposes, unnecessary during real use
 		GGNoRe::API::id_t PlayerId = 0;
 
+		// Buffer of the latest de/serialization, shared by the next save state if the content did not change in between
+		std::shared_ptr<const SharedBinary> LatestBinary;
+
+		static inline bool HasSameContent(const SharedBinary& Binary, const std::vector<uint8_t>& StateBinary)
+		{
+			return std::equal(Binary.Buffer.cbegin(), Binary.Buffer.cend(), StateBinary.cbegin(), StateBinary.cend());
+		}
+
+		std::unique_ptr<ABS_SaveState> Serialize()
+		{
+			++SaveStatesStatisticsInternal.SerializedCount;
+
+			// Comparing the content is what makes sharing safe, flagging the modifications instead would rely on every piece of code writing to the state to do it
+			auto& StateBinary = SerializedState.UploadBinary();
+
+			if (LatestBinary && HasSameContent(*LatestBinary, StateBinary))
+			{
+				++SaveStatesStatisticsInternal.SharedBuffersCount;
+			}
+			else
+			{
+				LatestBinary = std::allocate_shared<SharedBinary>(TEST_ArenaAllocator<SharedBinary>(Arena), StateBinary, Arena);
+				SaveStatesStatisticsInternal.SerializedSizeInBytes += StateBinary.size();
+			}
+
+			return std::make_unique<SaveState>(LatestBinary);
+		}
+
 	public:
-		TEST_CPT_RB_SaveStates(TEST_CPT_State& PlayerState)
-			:PlayerState(PlayerState)
+		TEST_CPT_RB_SaveStates(SerializableT& SerializedState, TEST_Arena& Arena)
+			:SerializedState(SerializedState), Arena(Arena)
 		{}
 
 		~TEST_CPT_RB_SaveStates() = default;
@@ -213,23 +335,41 @@ private:
 
 		std::unique_ptr<ABS_SaveState> OnSerialize(const uint16_t FrameIndex) override
 		{
-			PlayerState.State.LogHumanReadable(FrameIndex, "{TEST SAVE STATES SERIALIZE - PLAYER " + std::to_string(PlayerId) + "}", ABS_DBG_HumanReadable::LoggingLevel_E::Dump);
+			TEST_NSPC_Allocations::Scope SaveStatesScope(TEST_NSPC_Allocations::Subsystem_E::SaveStates);
 
-			auto& StateBinary = PlayerState.State.UploadBinary();
+			// Outside of the timing, which would otherwise mostly measure the logging
+			SerializedState.LogHumanReadable(FrameIndex, "{TEST SAVE STATES SERIALIZE - PLAYER " + std::to_string(PlayerId) + "}", ABS_DBG_HumanReadable::LoggingLevel_E::Dump);
 
-			return std::make_unique<SaveState>(StateBinary);
+			const auto SerializationStart = std::chrono::steady_clock::now();
+			auto Serialized = Serialize();
+			SaveStatesStatisticsInternal.SerializationDuration += std::chrono::steady_clock::now() - SerializationStart;
+
+			return Serialized;
 		}
 
 		void OnDeserialize(const std::unique_ptr<ABS_SaveState>& SourceBuffer, const uint16_t FrameIndex) override
 		{
 			assert(SourceBuffer.get()->Size() > 0);
 
-			PlayerState.State.DownloadBinary(SourceBuffer->Binary());
+			TEST_NSPC_Allocations::Scope SaveStatesScope(TEST_NSPC_Allocations::Subsystem_E::SaveStates);
+
+			++SaveStatesStatisticsInternal.DeserializedCount;
+
+			// Only this component creates its save states
+			const auto& Source = static_cast<const SaveState&>(*SourceBuffer);
 
-			PlayerState.State.LogHumanReadable(FrameIndex, "{TEST SAVE STATES DESERIALIZE - PLAYER " + std::to_string(PlayerId) + "}", ABS_DBG_HumanReadable::LoggingLevel_E::Dump);
+			// So that the next serialization shares this buffer if the frame leaves the state unchanged
+			LatestBinary = Source.Shared();
+
+			SerializedState.DownloadBinary(Source.Binary());
+
+			SerializedState.LogHumanReadable(FrameIndex, "{TEST SAVE STATES DESERIALIZE - PLAYER " + std::to_string(PlayerId) + "}", ABS_DBG_HumanReadable::LoggingLevel_E::Dump);
 		}
 
-		void ResetAndCleanup() noexcept override {}
+		void ResetAndCleanup() noexcept override
+		{
+			LatestBinary.reset();
+		}
 	};
 
 	// ABS_CPT_RB_Simulator is a helper component in case you build your game from scratch with GGNoRe
@@ -264,6 +404,8 @@ private:
 
 		void OnSimulateFrame(const uint16_t SimulatedFrameIndex, const std::set<uint8_t>& Inputs) override
 		{
+			TEST_NSPC_Allocations::Scope UserScope(TEST_NSPC_Allocations::Subsystem_E::User);
+
 			for (auto Input : Inputs)
 			{
 				std::get<TEST_CPT_State::StateKeys_E::InputsAccumulator>(PlayerState.State.Values()) += Input;
@@ -272,6 +414,7 @@ private:
 			if (std::get<TEST_CPT_State::StateKeys_E::PrimedForFireball>(PlayerState.State.Values()) && Inputs.find(TEST_NSPC_Systems::FireballCombo[1]) != Inputs.cend())
 			{
 				TEST_Fireball::CastFireball(OwnerAtFrame(SimulatedFrameIndex));
+				++std::get<TEST_CPT_State::CastsKeys_E::FireballsCastCount>(PlayerState.Casts.Values());
 			}
 
 			std::get<TEST_CPT_State::StateKeys_E::PrimedForFireball>(PlayerState.State.Values()) = false;
@@ -284,6 +427,8 @@ private:
 
 		void OnSimulateTick(const GGNoRe::API::SER_FixedPoint DeltaDurationInSeconds) override
 		{
+			TEST_NSPC_Allocations::Scope UserScope(TEST_NSPC_Allocations::Subsystem_E::User);
+
 			std::get<TEST_CPT_State::StateKeys_E::DeltaDurationAccumulatorInSeconds>(PlayerState.State.Values()) =
 				(GGNoRe::API::SER_FixedPoint(std::get<TEST_CPT_State::StateKeys_E::DeltaDurationAccumulatorInSeconds>(PlayerState.State.Values())) + DeltaDurationInSeconds).Serializable();
 		}
@@ -300,6 +445,10 @@ private:
 	// The module has no global state beside configuration and active components trackers so the user does not have to manually instantiate them, but it could easily be made free of any global state
 	static std::set<TEST_Player*> PlayersInternal;
 	static uint32_t DebugIdCounter;
+	static SaveStatesStatistics SaveStatesStatisticsInternal;
+	static TEST_RelevanceIndex<TEST_CPT_IPT_Emulator> InputsRelevanceInternal;
+	static bool RecordsUploadsInternal;
+	static std::map<GGNoRe::API::id_t, std::vector<UploadedInputs>> PlayerIdToUploadsInternal;
 
 	// To identify more quickly which is which when debugging
 	uint32_t DebugId = 0;
@@ -307,9 +456,32 @@ private:
 	TEST_CPT_State StateInternal;
 
 	TEST_CPT_IPT_Emulator EmulatorInternal;
-	TEST_CPT_RB_SaveStates SaveStatesInternal;
+	TEST_CPT_RB_SaveStates<TEST_CPT_State::SerializableState> SaveStatesInternal;
+	TEST_CPT_RB_SaveStates<TEST_CPT_State::SerializableCasts> CastsSaveStatesInternal;
 	TEST_CPT_RB_Simulator SimulatorInternal;
 
+	// Call site helpers only, they save repeating the same activation change for every component but nothing is grouped in the module
+	// Each component registers its own activation change in the order of the arguments, and the module tracks, reverts and reapplies one entry per component
+	// Not atomic: when the registration of a component throws, the components before it stay registered, which is fine here since every caller treats a failed registration as fatal
+	template<typename... ComponentsT> static void ChangeEachActivationNow(const GGNoRe::API::DATA_Player Owner, const GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E Type, ComponentsT&... Components)
+	{
+		TEST_NSPC_Allocations::Scope ActivationScope(TEST_NSPC_Allocations::Subsystem_E::ActivationJournal);
+
+		// Braced initializer lists are evaluated from left to right
+		const int Expansion[] = { (Components.ChangeActivationNow(Owner, Type), 0)... };
+		(void)Expansion;
+	}
+
+	template<typename... ComponentsT> static void ChangeEachActivationInPast(const GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent ActivationChange, ComponentsT&... Components)
+	{
+		TEST_NSPC_Allocations::Scope ActivationScope(TEST_NSPC_Allocations::Subsystem_E::ActivationJournal);
+
+		// The second argument is the processing order, necessary when changing a past activation because the checksum is order dependent
+		uint8_t ProcessingOrder = 0;
+		const int Expansion[] = { (Components.ChangeActivationInPast(ActivationChange, { true, ProcessingOrder++ }), 0)... };
+		(void)Expansion;
+	}
+
 	void OnActivateNow(const GGNoRe::API::DATA_Player Owner)
 	{
 		assert(PlayersInternal.find(this) == PlayersInternal.cend());
@@ -318,9 +490,7 @@ private:
 
 		PlayersInternal.insert(this);
 
-		EmulatorInternal.ChangeActivationNow(Owner, GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E::Activate);
-		SaveStatesInternal.ChangeActivationNow(Owner, GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E::Activate);
-		SimulatorInternal.ChangeActivationNow(Owner, GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E::Activate);
+		ChangeEachActivationNow(Owner, GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E::Activate, EmulatorInternal, SaveStatesInternal, CastsSaveStatesInternal, SimulatorInternal);
 	}
 
 	void OnActivateInPast(const GGNoRe::API::DATA_Player Owner, const uint16_t StartFrameIndex)
@@ -331,15 +501,13 @@ private:
 
 		PlayersInternal.insert(this);
 
-		// The second argument is the processing order, necessary when changing a past activation because the checksum is order dependent
-		EmulatorInternal.ChangeActivationInPast({ GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E::Activate, Owner, StartFrameIndex }, { true, 0 });
-		SaveStatesInternal.ChangeActivationInPast({ GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E::Activate, Owner, StartFrameIndex }, { true, 1 });
-		SimulatorInternal.ChangeActivationInPast({ GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E::Activate, Owner, StartFrameIndex }, { true, 2 });
+		ChangeEachActivationInPast({ GGNoRe::API::I_RB_Rollbackable::ActivationChangeEvent::ChangeType_E::Activate, Owner, StartFrameIndex }, EmulatorInternal, SaveStatesInternal, CastsSaveStatesInternal, SimulatorInternal);
 	}
 
 public:
-	TEST_Player()
-		:EmulatorInternal(), SaveStatesInternal(StateInternal), SimulatorInternal(StateInternal)
+	// The arena must outlive the player
+	explicit TEST_Player(TEST_Arena& Arena)
+		:EmulatorInternal(), SaveStatesInternal(StateInternal.State, Arena), CastsSaveStatesInternal(StateInternal.Casts, Arena), SimulatorInternal(StateInternal)
 	{
 	}
 
@@ -353,11 +521,40 @@ public:
 		return PlayersInternal;
 	}
 
+	// Which emulators have to send their inputs to which system
+	static inline TEST_RelevanceIndex<TEST_CPT_IPT_Emulator>& InputsRelevance()
+	{
+		return InputsRelevanceInternal;
+	}
+
+	// Only while there are spectators, so that the other runs do not copy every packet
+	static inline void RecordUploads(const bool Records)
+	{
+		RecordsUploadsInternal = Records;
+	}
+
+	// The uploads not broadcast yet, per player, the vectors are emptied rather than erased so that they keep their capacity
+	static inline std::map<GGNoRe::API::id_t, std::vector<UploadedInputs>>& PlayerIdToUploads()
+	{
+		return PlayerIdToUploadsInternal;
+	}
+
+	static inline const SaveStatesStatistics& SaveStatesUsage()
+	{
+		return SaveStatesStatisticsInternal;
+	}
+
 	inline const TEST_CPT_State& State() const
 	{
 		return StateInternal;
 	}
 
+	// What OnSimulateTick outputs
+	inline int64_t DeltaDurationAccumulatorInSeconds()
+	{
+		return std::get<TEST_CPT_State::StateKeys_E::DeltaDurationAccumulatorInSeconds>(StateInternal.State.Values());
+	}
+
 	inline const TEST_CPT_IPT_Emulator& Emulator() const
 	{
 		return EmulatorInternal;
@@ -397,4 +594,8 @@ public:
 };
 
 std::set<TEST_Player*> TEST_Player::PlayersInternal;
-uint32_t TEST_Player::DebugIdCounter = 0;
\ No newline at end of file
+uint32_t TEST_Player::DebugIdCounter = 0;
+TEST_Player::SaveStatesStatistics TEST_Player::SaveStatesStatisticsInternal;
+TEST_RelevanceIndex<TEST_Player::TEST_CPT_IPT_Emulator> TEST_Player::InputsRelevanceInternal;
+bool TEST_Player::RecordsUploadsInternal = false;
+std::map<GGNoRe::API::id_t, std::vector<TEST_Player::UploadedInputs>> TEST_Player::PlayerIdToUploadsInternal;
\ No newline at end of file
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2022 Loic Venerosy
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+// Keeps, for every target system, the list of the sources whose inputs it needs, updated incrementally when systems join and when sources change owner
+// Fanning the inputs out then costs as much as the relevant pairs, instead of going through every player of every system for every target
+// A significance manager deciding what each client simulates would plug in here by publishing a source to a subset of the targets only
+template<typename SourceT> class TEST_RelevanceIndex final
+{
+	std::set<uint8_t> Targets;
+	// Only the sources owned by a local player publish their inputs
+	std::map<const SourceT*, uint8_t> PublisherToSystemIndex;
+	std::map<uint8_t, std::vector<const SourceT*>> TargetToRelevantSources;
+
+	static const std::vector<const SourceT*>& NoSources()
+	{
+		static const std::vector<const SourceT*> Empty;
+		return Empty;
+	}
+
+	void Unsubscribe(const SourceT& Source, const uint8_t SourceSystemIndex)
+	{
+		for (auto Target : Targets)
+		{
+			if (Target == SourceSystemIndex)
+			{
+				continue;
+			}
+
+			auto& Sources = TargetToRelevantSources[Target];
+			const auto SourceIt = std::find(Sources.cbegin(), Sources.cend(), &Source);
+			assert(SourceIt != Sources.cend());
+			Sources.erase(SourceIt);
+		}
+	}
+
+public:
+	TEST_RelevanceIndex() = default;
+	~TEST_RelevanceIndex() = default;
+
+	inline const std::set<uint8_t>& TargetSystemIndexes() const
+	{
+		return Targets;
+	}
+
+	// Every source publishing its inputs, along with its system
+	inline const std::map<const SourceT*, uint8_t>& Publishers() const
+	{
+		return PublisherToSystemIndex;
+	}
+
+	inline const std::vector<const SourceT*>& SourcesRelevantTo(const uint8_t TargetSystemIndex) const
+	{
+		const auto SourcesIt = TargetToRelevantSources.find(TargetSystemIndex);
+		return SourcesIt == TargetToRelevantSources.cend() ? NoSources() : SourcesIt->second;
+	}
+
+	void AddTarget(const uint8_t TargetSystemIndex)
+	{
+		assert(Targets.find(TargetSystemIndex) == Targets.cend());
+
+		Targets.insert(TargetSystemIndex);
+
+		auto& Sources = TargetToRelevantSources[TargetSystemIndex];
+		assert(Sources.empty());
+		for (const auto& Publisher : PublisherToSystemIndex)
+		{
+			if (Publisher.second != TargetSystemIndex)
+			{
+				Sources.push_back(Publisher.first);
+			}
+		}
+	}
+
+	// Publishing again under another system moves the source
+	void Publish(const SourceT& Source, const uint8_t SourceSystemIndex)
+	{
+		const auto PublisherIt = PublisherToSystemIndex.find(&Source);
+		if (PublisherIt != PublisherToSystemIndex.cend())
+		{
+			if (PublisherIt->second == SourceSystemIndex)
+			{
+				return;
+			}
+
+			Unpublish(Source);
+		}
+
+		PublisherToSystemIndex.emplace(&Source, SourceSystemIndex);
+
+		for (auto Target : Targets)
+		{
+			if (Target != SourceSystemIndex)
+			{
+				TargetToRelevantSources[Target].push_back(&Source);
+			}
+		}
+	}
+
+	void Unpublish(const SourceT& Source)
+	{
+		const auto PublisherIt = PublisherToSystemIndex.find(&Source);
+		if (PublisherIt == PublisherToSystemIndex.cend())
+		{
+			return;
+		}
+
+		Unsubscribe(Source, PublisherIt->second);
+
+		PublisherToSystemIndex.erase(PublisherIt);
+	}
+
+	// The lists of sources keep their capacity for the next session
+	void Clear()
+	{
+		Targets.clear();
+		PublisherToSystemIndex.clear();
+		for (auto& Sources : TargetToRelevantSources)
+		{
+			Sources.second.clear();
+		}
+	}
+};
\ No newline at end of file
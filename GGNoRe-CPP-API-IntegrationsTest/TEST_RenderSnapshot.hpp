@@ -0,0 +1,62 @@
+/*
+ * Copyright 2022 Loic Venerosy
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands the state of the latest completed frame over from the simulation thread to the render thread without locking
+// The simulation writes in a buffer the render thread cannot see then publishes it with a single atomic exchange, so the rendering never observes a frame in the middle of a rollback
+// It is a double buffer with a spare: the spare is what lets the simulation publish a new frame while the render thread still reads the previous one, neither thread ever waits for the other
+template<typename T> class TEST_RenderSnapshot final
+{
+	static constexpr uint8_t IndexMask = 0b011;
+	// Set when the published buffer was not read yet
+	static constexpr uint8_t FreshFlag = 0b100;
+
+	std::array<T, 3> Buffers{};
+
+	// Only touched by the simulation thread
+	uint8_t WritingIndex = 0;
+	// Exchanged between both threads
+	std::atomic<uint8_t> Published{ 1 };
+	// Only touched by the render thread
+	uint8_t ReadingIndex = 2;
+
+public:
+	TEST_RenderSnapshot() = default;
+
+	TEST_RenderSnapshot(const TEST_RenderSnapshot&) = delete;
+	TEST_RenderSnapshot& operator=(const TEST_RenderSnapshot&) = delete;
+
+	~TEST_RenderSnapshot() = default;
+
+	// Simulation thread
+	inline T& Back()
+	{
+		return Buffers[WritingIndex];
+	}
+
+	// Simulation thread, the back buffer must be complete
+	void Publish()
+	{
+		WritingIndex = Published.exchange(WritingIndex | FreshFlag, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	// Render thread, the reference stays valid and unchanged until the next call
+	const T& Read()
+	{
+		if (Published.load(std::memory_order_relaxed) & FreshFlag)
+		{
+			ReadingIndex = Published.exchange(ReadingIndex, std::memory_order_acq_rel) & IndexMask;
+		}
+
+		return Buffers[ReadingIndex];
+	}
+};
+
+template<typename T> constexpr uint8_t TEST_RenderSnapshot<T>::IndexMask;
+template<typename T> constexpr uint8_t TEST_RenderSnapshot<T>::FreshFlag;
\ No newline at end of file
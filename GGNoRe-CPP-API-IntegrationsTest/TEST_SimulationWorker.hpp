@@ -0,0 +1,114 @@
+/*
+ * Copyright 2022 Loic Venerosy
+ */
+
+#pragma once
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Thread kept alive for the whole run and simulating one job at a time, so that pipelining the simulation does not start a thread per frame
+class TEST_SimulationWorker final
+{
+	std::mutex Mutex;
+	std::condition_variable JobPosted;
+	std::condition_variable JobDone;
+
+	std::function<void()> Job;
+	bool Busy = false;
+	bool Stopping = false;
+	std::exception_ptr Failure;
+
+	// Declared last so that everything above is ready when the thread starts
+	std::thread Thread;
+
+	void Loop()
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		while (true)
+		{
+			JobPosted.wait(Lock, [this] { return Busy || Stopping; });
+			if (!Busy)
+			{
+				return;
+			}
+
+			Lock.unlock();
+
+			std::exception_ptr JobFailure;
+			try
+			{
+				Job();
+			}
+			catch (...)
+			{
+				JobFailure = std::current_exception();
+			}
+
+			Lock.lock();
+
+			Failure = JobFailure;
+			Busy = false;
+			JobDone.notify_all();
+		}
+	}
+
+public:
+	TEST_SimulationWorker()
+		:Thread(&TEST_SimulationWorker::Loop, this)
+	{}
+
+	TEST_SimulationWorker(const TEST_SimulationWorker&) = delete;
+	TEST_SimulationWorker& operator=(const TEST_SimulationWorker&) = delete;
+
+	~TEST_SimulationWorker()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			assert(!Busy);
+			Stopping = true;
+		}
+		JobPosted.notify_all();
+
+		Thread.join();
+	}
+
+	// The previous job must be done
+	void Post(std::function<void()> NewJob)
+	{
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			assert(!Busy);
+
+			Job = std::move(NewJob);
+			Busy = true;
+		}
+		JobPosted.notify_one();
+	}
+
+	// True once the job is done, sleeps for at most the duration otherwise
+	template<typename RepT, typename PeriodT> bool WaitFor(const std::chrono::duration<RepT, PeriodT> Duration)
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		return JobDone.wait_for(Lock, Duration, [this] { return !Busy; });
+	}
+
+	// Rethrows on the calling thread what the job threw
+	void Wait()
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		JobDone.wait(Lock, [this] { return !Busy; });
+
+		if (Failure)
+		{
+			std::exception_ptr JobFailure = Failure;
+			Failure = nullptr;
+			std::rethrow_exception(JobFailure);
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2022 Loic Venerosy
+ */
+
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+struct SweepParameter
+{
+	size_t ValuesCount = 0;
+	std::function<void(const size_t ValueIndex)> SelectValue;
+};
+
+template<typename T, std::size_t N> SweepParameter GetSweepParameter(const std::array<T, N> ValueRange, T& Value) noexcept
+{
+	static_assert(N > 0, "A parameter needs at least one value");
+
+	return
+	{
+		N,
+		[ValueRange, &Value](const size_t ValueIndex)
+		{
+			Value = ValueRange[ValueIndex];
+		}
+	};
+}
+
+// Plans which configurations to test, either the full cartesian product of the parameters for nightly runs or a t-wise covering set for quick runs
+// A t-wise covering set contains every combination of values of any t parameters at least once, which catches the bugs caused by the interaction of up to t parameters for a fraction of the cost
+// The configurations that the tests would skip anyway are pruned before running, and are never used to cover a combination
+class TEST_SweepPlanner final
+{
+public:
+	enum class Coverage_E : uint8_t
+	{
+		Exhaustive,
+		Pairwise,
+		ThreeWise
+	};
+
+	using Row = std::vector<size_t>;
+
+private:
+	const std::vector<SweepParameter> Parameters;
+	const std::function<bool()> IsSkipped;
+
+	// A group of t parameters along with which of their values combinations are already covered by the planned rows
+	struct Combination
+	{
+		std::vector<size_t> ParameterIndexes;
+		std::vector<bool> Covered;
+	};
+
+	static constexpr size_t Unassigned = SIZE_MAX;
+	// Every candidate row is built greedily from a different parameter ordering, the best one is kept
+	static constexpr size_t CandidatesPerRow = 20;
+	// Fixed so that the plan, and thus the test indexes, are the same from one run to the next
+	static constexpr uint32_t Seed = 2022;
+
+	void Select(const Row& Values) const
+	{
+		assert(Values.size() == Parameters.size());
+
+		for (size_t ParameterIndex = 0; ParameterIndex < Parameters.size(); ++ParameterIndex)
+		{
+			assert(Values[ParameterIndex] < Parameters[ParameterIndex].ValuesCount);
+			Parameters[ParameterIndex].SelectValue(Values[ParameterIndex]);
+		}
+	}
+
+	bool IsValid(const Row& Values) const
+	{
+		Select(Values);
+		return !IsSkipped();
+	}
+
+	// Returns false when the row is missing a value for one of the parameters of the combination
+	bool TryGetTupleIndex(const Combination& Group, const Row& Values, size_t& TupleIndex) const
+	{
+		TupleIndex = 0;
+		for (auto ParameterIndex : Group.ParameterIndexes)
+		{
+			if (Values[ParameterIndex] == Unassigned)
+			{
+				return false;
+			}
+
+			TupleIndex = TupleIndex * Parameters[ParameterIndex].ValuesCount + Values[ParameterIndex];
+		}
+
+		return true;
+	}
+
+	void SetTuple(const Combination& Group, size_t TupleIndex, Row& Values) const
+	{
+		for (auto ParameterIt = Group.ParameterIndexes.crbegin(); ParameterIt != Group.ParameterIndexes.crend(); ++ParameterIt)
+		{
+			Values[*ParameterIt] = TupleIndex % Parameters[*ParameterIt].ValuesCount;
+			TupleIndex /= Parameters[*ParameterIt].ValuesCount;
+		}
+	}
+
+	size_t CountNewlyCovered(const std::vector<Combination>& Combinations, const std::vector<size_t>& CombinationIndexes, const Row& Values) const
+	{
+		size_t NewlyCoveredCount = 0;
+		for (auto CombinationIndex : CombinationIndexes)
+		{
+			size_t TupleIndex = 0;
+			if (TryGetTupleIndex(Combinations[CombinationIndex], Values, TupleIndex) && !Combinations[CombinationIndex].Covered[TupleIndex])
+			{
+				++NewlyCoveredCount;
+			}
+		}
+
+		return NewlyCoveredCount;
+	}
+
+	// Walks the cartesian product of the unassigned parameters, the first parameter being the innermost loop
+	bool TryFindValidRow(Row& Values) const
+	{
+		Row Candidate = Values;
+		for (size_t ParameterIndex = 0; ParameterIndex < Parameters.size(); ++ParameterIndex)
+		{
+			if (Values[ParameterIndex] == Unassigned)
+			{
+				Candidate[ParameterIndex] = 0;
+			}
+		}
+
+		while (true)
+		{
+			if (IsValid(Candidate))
+			{
+				Values = Candidate;
+				return true;
+			}
+
+			size_t ParameterIndex = 0;
+			for (; ParameterIndex < Parameters.size(); ++ParameterIndex)
+			{
+				if (Values[ParameterIndex] != Unassigned)
+				{
+					continue;
+				}
+
+				if (++Candidate[ParameterIndex] < Parameters[ParameterIndex].ValuesCount)
+				{
+					break;
+				}
+
+				Candidate[ParameterIndex] = 0;
+			}
+
+			if (ParameterIndex == Parameters.size())
+			{
+				return false;
+			}
+		}
+	}
+
+	std::vector<Combination> GetCombinations(const size_t Strength) const
+	{
+		std::vector<Combination> Combinations;
+
+		std::vector<size_t> ParameterIndexes(Strength);
+		for (size_t Index = 0; Index < Strength; ++Index)
+		{
+			ParameterIndexes[Index] = Index;
+		}
+
+		// Lexicographic enumeration of the subsets of size Strength
+		while (true)
+		{
+			size_t TuplesCount = 1;
+			for (auto ParameterIndex : ParameterIndexes)
+			{
+				TuplesCount *= Parameters[ParameterIndex].ValuesCount;
+			}
+			Combinations.push_back({ ParameterIndexes, std::vector<bool>(TuplesCount, false) });
+
+			size_t Position = Strength;
+			while (Position > 0 && ParameterIndexes[Position - 1] == Parameters.size() - Strength + Position - 1)
+			{
+				--Position;
+			}
+
+			if (Position == 0)
+			{
+				return Combinations;
+			}
+
+			++ParameterIndexes[Position - 1];
+			for (size_t Index = Position; Index < Strength; ++Index)
+			{
+				ParameterIndexes[Index] = ParameterIndexes[Index - 1] + 1;
+			}
+		}
+	}
+
+	// Greedy construction in the spirit of AETG: every new row starts from the first uncovered tuple then each remaining parameter takes the value covering the most new tuples
+	std::vector<Row> PlanCovering(const size_t Strength) const
+	{
+		assert(Strength > 0 && Strength <= Parameters.size());
+
+		auto Combinations = GetCombinations(Strength);
+
+		std::vector<std::vector<size_t>> ParameterIndexToCombinationIndexes(Parameters.size());
+		std::vector<size_t> AllCombinationIndexes(Combinations.size());
+		for (size_t CombinationIndex = 0; CombinationIndex < Combinations.size(); ++CombinationIndex)
+		{
+			AllCombinationIndexes[CombinationIndex] = CombinationIndex;
+
+			for (auto ParameterIndex : Combinations[CombinationIndex].ParameterIndexes)
+			{
+				ParameterIndexToCombinationIndexes[ParameterIndex].push_back(CombinationIndex);
+			}
+		}
+
+		// The raw engine output is fully specified by the standard unlike the distributions, so the shuffle is done by hand to get the same plan on every toolchain
+		std::mt19937 Generator(Seed);
+
+		std::vector<Row> Rows;
+
+		size_t CombinationIndex = 0;
+		size_t TupleIndex = 0;
+		while (CombinationIndex < Combinations.size())
+		{
+			if (TupleIndex == Combinations[CombinationIndex].Covered.size())
+			{
+				++CombinationIndex;
+				TupleIndex = 0;
+				continue;
+			}
+
+			if (Combinations[CombinationIndex].Covered[TupleIndex])
+			{
+				++TupleIndex;
+				continue;
+			}
+
+			Row Seeded(Parameters.size(), Unassigned);
+			SetTuple(Combinations[CombinationIndex], TupleIndex, Seeded);
+
+			Row BestRow;
+			size_t BestNewlyCoveredCount = 0;
+
+			for (size_t CandidateIndex = 0; CandidateIndex < CandidatesPerRow; ++CandidateIndex)
+			{
+				Row Candidate = Seeded;
+
+				std::vector<size_t> Order;
+				for (size_t ParameterIndex = 0; ParameterIndex < Parameters.size(); ++ParameterIndex)
+				{
+					if (Candidate[ParameterIndex] == Unassigned)
+					{
+						Order.push_back(ParameterIndex);
+					}
+				}
+				for (size_t Index = Order.size(); Index > 1; --Index)
+				{
+					std::swap(Order[Index - 1], Order[Generator() % Index]);
+				}
+
+				for (auto ParameterIndex : Order)
+				{
+					size_t BestValueIndex = 0;
+					size_t BestValueNewlyCoveredCount = 0;
+					for (size_t ValueIndex = 0; ValueIndex < Parameters[ParameterIndex].ValuesCount; ++ValueIndex)
+					{
+						Candidate[ParameterIndex] = ValueIndex;
+						const auto NewlyCoveredCount = CountNewlyCovered(Combinations, ParameterIndexToCombinationIndexes[ParameterIndex], Candidate);
+						if (NewlyCoveredCount > BestValueNewlyCoveredCount)
+						{
+							BestValueIndex = ValueIndex;
+							BestValueNewlyCoveredCount = NewlyCoveredCount;
+						}
+					}
+					Candidate[ParameterIndex] = BestValueIndex;
+				}
+
+				if (!IsValid(Candidate))
+				{
+					continue;
+				}
+
+				const auto NewlyCoveredCount = CountNewlyCovered(Combinations, AllCombinationIndexes, Candidate);
+				if (NewlyCoveredCount > BestNewlyCoveredCount)
+				{
+					BestRow = Candidate;
+					BestNewlyCoveredCount = NewlyCoveredCount;
+				}
+			}
+
+			// The greedy candidates only ever break the skip rules by chance, so fall back to searching for any valid row holding the tuple
+			if (BestRow.empty())
+			{
+				if (!TryFindValidRow(Seeded))
+				{
+					// No configuration that is actually tested contains this tuple, there is nothing to cover
+					Combinations[CombinationIndex].Covered[TupleIndex] = true;
+					continue;
+				}
+
+				BestRow = Seeded;
+			}
+
+			for (auto& Group : Combinations)
+			{
+				size_t CoveredTupleIndex = 0;
+				const bool Assigned = TryGetTupleIndex(Group, BestRow, CoveredTupleIndex);
+				assert(Assigned);
+				Group.Covered[CoveredTupleIndex] = true;
+			}
+
+			Rows.push_back(BestRow);
+		}
+
+		return Rows;
+	}
+
+public:
+	TEST_SweepPlanner(const std::vector<SweepParameter> Parameters, const std::function<bool()> IsSkipped)
+		:Parameters(Parameters), IsSkipped(IsSkipped)
+	{
+		assert(!Parameters.empty());
+		assert(IsSkipped);
+	}
+
+	~TEST_SweepPlanner() = default;
+
+	inline size_t ExhaustiveCount() const
+	{
+		size_t Count = 1;
+		for (const auto& Parameter : Parameters)
+		{
+			Count *= Parameter.ValuesCount;
+		}
+
+		return Count;
+	}
+
+	// The test is called once per planned configuration, after the values have been written to the parameters
+	// In exhaustive mode the test index is the position in the full cartesian product, pruned configurations included, so a failing test index stays the same from one run to the next
+	void Run(const Coverage_E Coverage, const std::function<void(const size_t TestIndex, const size_t TestsCount)>& Test) const
+	{
+		if (Coverage == Coverage_E::Exhaustive)
+		{
+			const auto TestsCount = ExhaustiveCount();
+
+			Row Values(Parameters.size(), 0);
+			for (size_t TestIndex = 1; TestIndex <= TestsCount; ++TestIndex)
+			{
+				if (IsValid(Values))
+				{
+					Test(TestIndex, TestsCount);
+				}
+
+				for (size_t ParameterIndex = 0; ParameterIndex < Parameters.size(); ++ParameterIndex)
+				{
+					if (++Values[ParameterIndex] < Parameters[ParameterIndex].ValuesCount)
+					{
+						break;
+					}
+
+					Values[ParameterIndex] = 0;
+				}
+			}
+		}
+		else
+		{
+			const auto Rows = PlanCovering(Coverage == Coverage_E::Pairwise ? 2 : 3);
+
+			for (size_t RowIndex = 0; RowIndex < Rows.size(); ++RowIndex)
+			{
+				Select(Rows[RowIndex]);
+				Test(RowIndex + 1, Rows.size());
+			}
+		}
+	}
+};
+
+constexpr size_t TEST_SweepPlanner::Unassigned;
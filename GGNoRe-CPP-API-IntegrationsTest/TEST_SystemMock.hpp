@@ -4,28 +4,135 @@
 
 #pragma once
 
+#include <TEST_InputsBroadcast.hpp>
 #include <TEST_Player.hpp>
+#include <TEST_RenderSnapshot.hpp>
 
 namespace TEST_NSPC_Systems
 {
 
 std::set<uint8_t> SystemIndexes;
 
+// Back the save states of the players of each system, kept from one test to the next so that a new test reuses the blocks of the previous one instead of going through the heap again
+std::array<TEST_Arena, UINT8_MAX + 1> SystemArenas;
+
+// Every rollback is the cost of a misprediction of the remote inputs, these numbers allow comparing prediction strategies
+struct RollbackStatistics
+{
+	size_t NewFramesCount = 0;
+	size_t RollbacksCount = 0;
+	size_t ResimulatedFramesCount = 0;
+	size_t DeepestRollbackInFrames = 0;
+	std::chrono::steady_clock::duration ResimulationDuration{};
+};
+RollbackStatistics RollbackUsage;
+
+// Every spectator of the session reads this stream instead of downloading the inputs of every player
+TEST_InputsBroadcast InputsBroadcast;
+
+// The packets are built once whatever the number of spectators, delivering only shares them
+struct BroadcastStatistics
+{
+	size_t ChunksCount = 0;
+	size_t SizeInBytes = 0;
+	size_t DeliveredChunksCount = 0;
+};
+BroadcastStatistics BroadcastUsage;
+
+// The players sending their inputs to at least one system of the session, reused from one transfer to the next
+std::vector<GGNoRe::API::id_t> BroadcastPlayerIds;
+// The first spectator replays the stream instead of only counting it, this is the latest frame it replayed per player
+std::map<GGNoRe::API::id_t, uint16_t> ReplayedPlayerIdToFrameIndex;
+
 void TransferLocalPlayersInputs()
 {
+	const auto& InputsRelevance = TEST_Player::InputsRelevance();
+
+	// Nothing is built for the spectators when there are none
+	const bool Broadcasts = InputsBroadcast.SpectatorsCount() > 0;
+
 	for (auto CurrentSystemIndex : SystemIndexes)
 	{
 		auto LocalFrameIndex = GGNoRe::API::SystemMultiton::GetRollbackable(CurrentSystemIndex).UnsimulatedFrameIndex();
 
-		const auto& Players = TEST_Player::Players();
-		for (auto Player : Players)
+#ifndef NDEBUG
+		// The index must not miss any pair either, which the assert in the loop below cannot tell
+		size_t ScannedSourcesCount = 0;
+		for (auto Player : TEST_Player::Players())
 		{
-			if (Player->Emulator().ShouldSendInputsToTarget(CurrentSystemIndex))
+			ScannedSourcesCount += Player->Emulator().ShouldSendInputsToTarget(CurrentSystemIndex);
+		}
+		assert(ScannedSourcesCount == InputsRelevance.SourcesRelevantTo(CurrentSystemIndex).size());
+#endif
+
+		// Only goes through the emulators that have to send their inputs to this system instead of every player
+		for (auto Emulator : InputsRelevance.SourcesRelevantTo(CurrentSystemIndex))
+		{
+			assert(Emulator->ShouldSendInputsToTarget(CurrentSystemIndex));
+
+			TestLog("############ INPUT TRANSFER FROM PLAYER " + std::to_string(Emulator->Owner().Id) + " TO SYSTEM " + std::to_string(CurrentSystemIndex) + " - FRAME " + std::to_string(LocalFrameIndex) + " ############");
 			{
-				TestLog("############ INPUT TRANSFER FROM PLAYER " + std::to_string(Player->Emulator().Owner().Id) + " TO SYSTEM " + std::to_string(CurrentSystemIndex) + " - FRAME " + std::to_string(LocalFrameIndex) + " ############");
-				assert(GGNoRe::API::SystemMultiton::GetEmulator(CurrentSystemIndex).DownloadRemotePlayerBinary(Player->Emulator().LatestInputs().data()) == GGNoRe::API::ABS_CPT_IPT_Emulator::SINGLETON::DownloadSuccess_E::Success);
+				TEST_NSPC_Allocations::Scope EmulatorScope(TEST_NSPC_Allocations::Subsystem_E::Emulator);
+				assert(GGNoRe::API::SystemMultiton::GetEmulator(CurrentSystemIndex).DownloadRemotePlayerBinary(Emulator->LatestInputs().data()) == GGNoRe::API::ABS_CPT_IPT_Emulator::SINGLETON::DownloadSuccess_E::Success);
 			}
+
+			if (Broadcasts)
+			{
+				BroadcastPlayerIds.push_back(Emulator->Owner().Id);
+			}
+		}
+	}
+
+	if (!Broadcasts)
+	{
+		return;
+	}
+
+	// Once per player rather than once per target, the spectators are not systems of the session
+	// Sorted by player id so that the stream does not depend on where the emulators live in memory
+	std::sort(BroadcastPlayerIds.begin(), BroadcastPlayerIds.end());
+	BroadcastPlayerIds.erase(std::unique(BroadcastPlayerIds.begin(), BroadcastPlayerIds.end()), BroadcastPlayerIds.end());
+
+	auto& PlayerIdToUploads = TEST_Player::PlayerIdToUploads();
+	for (auto PlayerId : BroadcastPlayerIds)
+	{
+		// Every packet uploaded since the previous transfer, in the order of the uploads
+		auto& Uploads = PlayerIdToUploads[PlayerId];
+		for (const auto& Upload : Uploads)
+		{
+			InputsBroadcast.Append(PlayerId, Upload.FrameIndex, Upload.BinaryPacket);
+
+			++BroadcastUsage.ChunksCount;
+			BroadcastUsage.SizeInBytes += Upload.BinaryPacket->size();
 		}
+		Uploads.clear();
+	}
+	BroadcastPlayerIds.clear();
+
+	for (size_t SpectatorIndex = 0; SpectatorIndex < InputsBroadcast.SpectatorsCount(); ++SpectatorIndex)
+	{
+		InputsBroadcast.Deliver(SpectatorIndex, [SpectatorIndex](const TEST_InputsBroadcast::Chunk& Chunk)
+			{
+				assert(Chunk.BinaryPacket && !Chunk.BinaryPacket->empty());
+				++BroadcastUsage.DeliveredChunksCount;
+
+				if (SpectatorIndex == 0)
+				{
+					// A spectator feeding the stream to its emulator needs every frame of every player exactly once
+					// The broadcast appends whatever was uploaded, so this catches an emulator uploading a frame twice or skipping one
+					const auto ReplayedFrameIndexIt = ReplayedPlayerIdToFrameIndex.find(Chunk.PlayerId);
+					if (ReplayedFrameIndexIt != ReplayedPlayerIdToFrameIndex.cend())
+					{
+						assert(Chunk.FrameIndex == uint16_t(ReplayedFrameIndexIt->second + 1));
+						ReplayedFrameIndexIt->second = Chunk.FrameIndex;
+					}
+					else
+					{
+						ReplayedPlayerIdToFrameIndex.emplace(Chunk.PlayerId, Chunk.FrameIndex);
+					}
+				}
+			}
+		);
 	}
 }
 
@@ -34,6 +141,24 @@ void ForceResetAndCleanup()
 	GGNoRe::API::SystemMultiton::ForceResetAndCleanup();
 
 	SystemIndexes.clear();
+	TEST_Player::InputsRelevance().Clear();
+	InputsBroadcast.Clear();
+	ReplayedPlayerIdToFrameIndex.clear();
+	for (auto& Uploads : TEST_Player::PlayerIdToUploads())
+	{
+		Uploads.second.clear();
+	}
+}
+
+// Only once the players are destroyed, the reset releases the save states of the module but the players keep their latest ones
+void RewindArenas()
+{
+	assert(TEST_Player::SaveStatesUsage().AliveSizeInBytes == 0);
+
+	for (auto& Arena : SystemArenas)
+	{
+		Arena.Rewind();
+	}
 }
 
 class TEST_SystemMock final
@@ -45,6 +170,25 @@ public:
 		const bool AllowStallAdvantage = false;
 		const bool AllowStarvedForInput = false;
 		const bool AllowStayCurrent = false;
+		// Only concerns the module, checked from PreSimulation to PostSimulation
+		const bool AllowModuleAllocations = true;
+	};
+
+	// What rendering needs from the latest completed frame, namely what OnSimulateTick outputs
+	// Plain values so that publishing a frame does not copy the serialization buffers of the states
+	struct RenderState
+	{
+		uint16_t CompletedFrameIndex = 0;
+		int64_t ThisPlayerDeltaDurationAccumulatorInSeconds = 0;
+		int64_t OtherPlayerDeltaDurationAccumulatorInSeconds = 0;
+
+		inline bool operator==(const RenderState& Other) const
+		{
+			return
+				CompletedFrameIndex == Other.CompletedFrameIndex &&
+				ThisPlayerDeltaDurationAccumulatorInSeconds == Other.ThisPlayerDeltaDurationAccumulatorInSeconds &&
+				OtherPlayerDeltaDurationAccumulatorInSeconds == Other.OtherPlayerDeltaDurationAccumulatorInSeconds;
+		}
 	};
 
 private:
@@ -73,9 +217,18 @@ private:
 
 	const PlayersSetup Setup;
 
+	// Only when the rendering is pipelined, otherwise nothing reads the snapshot
+	const bool PublishRenderStates = false;
+	// Published once a tick completed a new frame, after the resimulation if any, so that the render thread never sees a frame in the middle of a rollback
+	TEST_RenderSnapshot<RenderState> RenderSnapshot;
+	// Simulation thread copy of the latest published state, to check what the render thread ends up reading
+	RenderState LatestPublishedRenderState;
+	// Render thread only
+	uint16_t LatestRenderedFrameIndex = 0;
+
 public:
-	TEST_SystemMock(const GGNoRe::API::DATA_Player ThisPlayerIdentity, const GGNoRe::API::DATA_Player OtherPlayerIdentity, const float DeltaDurationInSeconds, const PlayersSetup Setup)
-		:ThisPlayerIdentity(ThisPlayerIdentity), OtherPlayerIdentity(OtherPlayerIdentity), DeltaDurationInSeconds(DeltaDurationInSeconds), Setup(Setup)
+	TEST_SystemMock(const GGNoRe::API::DATA_Player ThisPlayerIdentity, const GGNoRe::API::DATA_Player OtherPlayerIdentity, const float DeltaDurationInSeconds, const PlayersSetup Setup, const bool PublishRenderStates)
+		:ThisPlayerIdentity(ThisPlayerIdentity), OtherPlayerIdentity(OtherPlayerIdentity), ThisPlayer(SystemArenas[ThisPlayerIdentity.SystemIndex]), OtherPlayer(SystemArenas[ThisPlayerIdentity.SystemIndex]), DeltaDurationInSeconds(DeltaDurationInSeconds), Setup(Setup), PublishRenderStates(PublishRenderStates)
 	{
 		assert(ThisPlayerIdentity.Local);
 		assert(!OtherPlayerIdentity.Local);
@@ -90,6 +243,23 @@ public:
 		return ThisPlayer.Emulator().ExistsAtFrame(GGNoRe::API::SystemMultiton::GetRollbackable(ThisPlayerIdentity.SystemIndex).UnsimulatedFrameIndex());
 	}
 
+	// Render thread only, stands for drawing the latest completed frame
+	void RenderLatestCompletedFrame()
+	{
+		assert(PublishRenderStates);
+
+		const auto& Completed = RenderSnapshot.Read();
+		// A rollback must never be visible, the rendered frames only move forward
+		assert(Completed.CompletedFrameIndex >= LatestRenderedFrameIndex);
+		LatestRenderedFrameIndex = Completed.CompletedFrameIndex;
+	}
+
+	// Render thread only, once the simulation thread is idle
+	inline bool RendersLatestPublishedFrame()
+	{
+		return RenderSnapshot.Read() == LatestPublishedRenderState;
+	}
+
 	void PreUpdate(const uint16_t TestFrameIndex, const TEST_SystemMock& OtherSystem)
 	{
 		if (!IsRunning() && TestFrameIndex == ThisPlayerIdentity.JoinFrameIndex)
@@ -99,6 +269,7 @@ public:
 
 			GGNoRe::API::SystemMultiton::GetRollbackable(ThisPlayerIdentity.SystemIndex).SyncWithRemoteFrameIndex(ThisPlayerIdentity.JoinFrameIndex);
 			SystemIndexes.insert(ThisPlayerIdentity.SystemIndex);
+			TEST_Player::InputsRelevance().AddTarget(ThisPlayerIdentity.SystemIndex);
 
 			try
 			{
@@ -171,6 +342,9 @@ public:
 
 		GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::TickHistory History;
 
+		// The configuration cannot change while ticking so it is read once instead of going through the singleton for every simulated frame
+		const auto SimulationConfiguration = GGNoRe::API::DATA_CFG::Get().SimulationConfiguration;
+
 		while (!ReadyForNextFrame)
 		{
 			TestLog("____________ SYSTEM " + std::to_string(ThisPlayerIdentity.SystemIndex) + " START - TICK " + std::to_string(MockTickIndex) + " ____________");
@@ -180,6 +354,9 @@ public:
 
 			auto& Rollbackable = GGNoRe::API::SystemMultiton::GetRollbackable(ThisPlayerIdentity.SystemIndex);
 
+			const auto ModuleAllocationsCountPreSimulation = TEST_NSPC_Allocations::ModuleAllocationsCount();
+			TEST_NSPC_Allocations::Scope RollbackScope(TEST_NSPC_Allocations::Subsystem_E::Rollback);
+
 			auto Plan = Rollbackable.PreSimulation(History);
 			assert((Plan.TickSuccess != GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::DoubleSimulation));
 			assert((Plan.TickSuccess != GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::NoActiveEmulator));
@@ -195,7 +372,10 @@ public:
 				{
 					assert(DeltaDurationInSeconds + DeltaDurationInSecondsConsumedPreActivationChange > 0.f);
 
-					Simulator.SimulateTick(DeltaDurationInSeconds, FrameIndex);
+					{
+						TEST_NSPC_Allocations::Scope SimulatorScope(TEST_NSPC_Allocations::Subsystem_E::Simulator);
+						Simulator.SimulateTick(DeltaDurationInSeconds, FrameIndex);
+					}
 
 					Rollbackable.PostTick(FrameIndex, DeltaDurationInSecondsConsumedPreActivationChange);
 				};
@@ -204,27 +384,39 @@ public:
 				{
 					assert(FrameIndex <= Rollbackable.UnsimulatedFrameIndex());
 
-					Simulator.SimulateFrame(FrameIndex, Emulator.GetPlayerIdToInputsAtFrame(FrameIndex));
+					TEST_NSPC_Allocations::Scope EmulatorScope(TEST_NSPC_Allocations::Subsystem_E::Emulator);
+					const auto& PlayerIdToInputs = Emulator.GetPlayerIdToInputsAtFrame(FrameIndex);
+
+					TEST_NSPC_Allocations::Scope SimulatorScope(TEST_NSPC_Allocations::Subsystem_E::Simulator);
+					Simulator.SimulateFrame(FrameIndex, PlayerIdToInputs);
 				};
 
 				const uint16_t ResimulationFramesCount = uint16_t(Plan.SimulationFramesCount - (Plan.TickSuccess == GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::ToNext));
 				if (ResimulationFramesCount > 0)
 				{
+					++RollbackUsage.RollbacksCount;
+					RollbackUsage.ResimulatedFramesCount += ResimulationFramesCount;
+					RollbackUsage.DeepestRollbackInFrames = std::max(RollbackUsage.DeepestRollbackInFrames, (size_t)ResimulationFramesCount);
+
 					const uint16_t RollbackFrameIndex = Rollbackable.UnsimulatedFrameIndex() - ResimulationFramesCount;
 
+					const auto ResimulationStart = std::chrono::steady_clock::now();
+
 					for (auto FrameOffset = 0; FrameOffset < ResimulationFramesCount; FrameOffset++)
 					{
 						const auto ExistingFrameIndex = RollbackFrameIndex + FrameOffset;
 
 						assert(ExistingFrameIndex < Rollbackable.UnsimulatedFrameIndex());
 
-						SimulateTick(GGNoRe::API::DATA_CFG::Get().SimulationConfiguration.FrameDurationInSeconds, 0.f, ExistingFrameIndex);
+						SimulateTick(SimulationConfiguration.FrameDurationInSeconds, 0.f, ExistingFrameIndex);
 
 						AdvanceToNextFrame(ExistingFrameIndex);
 
 						Rollbackable.PostResimulationFrame(ExistingFrameIndex, Plan.MostRecentValidFrameIndex);
 					}
 
+					RollbackUsage.ResimulationDuration += std::chrono::steady_clock::now() - ResimulationStart;
+
 					if (
 						History.ConsumedDeltaDurationInSecondsFromFrameStart > 0.f &&
 						Plan.TickSuccess != GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::StallAdvantage &&
@@ -241,13 +433,15 @@ public:
 				}
 				else if (Plan.TickSuccess == GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::ToNext)
 				{
-					const auto SimulateNewFrame = [this, &SimulateTick, &AdvanceToNextFrame, &Rollbackable](const GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::TickHistory History)
+					const auto SimulateNewFrame = [this, &SimulationConfiguration, &SimulateTick, &AdvanceToNextFrame, &Rollbackable](const GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::TickHistory History)
 					{
-						const GGNoRe::API::SER_FixedPoint DeltaToNextFrame = GGNoRe::API::DATA_CFG::Get().SimulationConfiguration.FrameDurationInSeconds - History.ConsumedDeltaDurationInSecondsFromFrameStart;
+						const GGNoRe::API::SER_FixedPoint DeltaToNextFrame = SimulationConfiguration.FrameDurationInSeconds - History.ConsumedDeltaDurationInSecondsFromFrameStart;
 						assert(DeltaToNextFrame >= 0.f);
 						SimulateTick(DeltaToNextFrame, History.ConsumedDeltaDurationInSecondsFromFrameStart, Rollbackable.UnsimulatedFrameIndex());
 
 						AdvanceToNextFrame(Rollbackable.UnsimulatedFrameIndex());
+
+						++RollbackUsage.NewFramesCount;
 					};
 
 					SimulateNewFrame(History);
@@ -259,7 +453,7 @@ public:
 					// you can just use the original plan and ignore the double simulation and setting AllowDoubleSimulation to false
 					if (Plan.TickSuccess == GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::DoubleSimulation)
 					{
-						assert(GGNoRe::API::DATA_CFG::Get().SimulationConfiguration.AllowDoubleSimulation);
+						assert(SimulationConfiguration.AllowDoubleSimulation);
 
 						SimulateNewFrame({});
 
@@ -274,6 +468,24 @@ public:
 
 			Rollbackable.PostSimulation(Plan);
 
+			assert(AllowedOutcomes.AllowModuleAllocations || TEST_NSPC_Allocations::ModuleAllocationsCount() == ModuleAllocationsCountPreSimulation);
+			TEST_NSPC_Allocations::Scope UserScope(TEST_NSPC_Allocations::Subsystem_E::User);
+
+			if (
+				PublishRenderStates && (
+					Plan.TickSuccess == GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::ToNext ||
+					Plan.TickSuccess == GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::DoubleSimulation
+					)
+				)
+			{
+				auto& Completed = RenderSnapshot.Back();
+				Completed.CompletedFrameIndex = uint16_t(Rollbackable.UnsimulatedFrameIndex() - 1);
+				Completed.ThisPlayerDeltaDurationAccumulatorInSeconds = ThisPlayer.DeltaDurationAccumulatorInSeconds();
+				Completed.OtherPlayerDeltaDurationAccumulatorInSeconds = OtherPlayer.DeltaDurationAccumulatorInSeconds();
+				LatestPublishedRenderState = Completed;
+				RenderSnapshot.Publish();
+			}
+
 			if (Plan.TickSuccess == GGNoRe::API::ABS_RB_Rollbackable::SINGLETON::SimulationPlan::TickSuccess_E::StayCurrent)
 			{
 				History.ConsumedDeltaDurationInSecondsFromFrameStart += DeltaDurationInSeconds;
@@ -318,9 +530,9 @@ public:
 			++MockTickIndex;
 
 			UpdateTimer += DeltaDurationInSeconds;
-			if (UpdateTimer >= GGNoRe::API::DATA_CFG::Get().SimulationConfiguration.FrameDurationInSeconds)
+			if (UpdateTimer >= SimulationConfiguration.FrameDurationInSeconds)
 			{
-				UpdateTimer -= GGNoRe::API::DATA_CFG::Get().SimulationConfiguration.FrameDurationInSeconds;
+				UpdateTimer -= SimulationConfiguration.FrameDurationInSeconds;
 				ReadyForNextFrame = true;
 			}
 		}
@@ -328,6 +540,7 @@ public:
 		// + 1 because should happen post TryTickingToNextFrame
 		if (!TransferInitialInputs && GGNoRe::API::SystemMultiton::GetRollbackable(ThisPlayerIdentity.SystemIndex).UnsimulatedFrameIndex() >= OtherPlayerIdentity.JoinFrameIndex + 1)
 		{
+			TEST_NSPC_Allocations::Scope EmulatorScope(TEST_NSPC_Allocations::Subsystem_E::Emulator);
 			InitialInputsToTransfer = GGNoRe::API::SystemMultiton::GetEmulator(ThisPlayerIdentity.SystemIndex).UploadInputsFromRemoteStartFrameIndex(OtherPlayerIdentity.JoinFrameIndex);
 			assert(InitialInputsToTransfer.UploadSuccess == GGNoRe::API::ABS_CPT_IPT_Emulator::SINGLETON::InputsBinaryPacketsForStartingRemote::UploadSuccess_E::Success);
 			TransferInitialInputs = true;
@@ -345,6 +558,7 @@ public:
 			for (const auto& OtherPlayerBinary : OtherSystem.InitialInputsToTransfer.InputsBinaryPackets)
 			{
 				TestLog("############ INITIAL INPUT TRANSFER FROM PLAYER " + std::to_string(OtherSystem.ThisPlayerIdentity.Id) + " TO SYSTEM " + std::to_string(ThisPlayerIdentity.SystemIndex) + " ############");
+				TEST_NSPC_Allocations::Scope EmulatorScope(TEST_NSPC_Allocations::Subsystem_E::Emulator);
 				assert(GGNoRe::API::SystemMultiton::GetEmulator(ThisPlayerIdentity.SystemIndex).DownloadRemotePlayerBinary(OtherPlayerBinary.data()) == GGNoRe::API::ABS_CPT_IPT_Emulator::SINGLETON::DownloadSuccess_E::Success);
 			}
 		}